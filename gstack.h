@@ -26,6 +26,69 @@
  *
  * You can define GSTACK_MALLOC, GSTACK_REALLOC, and GSTACK_FREE to avoid using 
  * malloc(), realloc(), and free().
+ *
+ * When the default allocator is used, the capacity of a stack is rounded up to
+ * whatever malloc_usable_size() reports, where available. On Linux, buffers of
+ * GSTACK_MMAP_THRESHOLD bytes or more (1 MiB unless defined) are mapped with
+ * mmap() and grown with mremap(), so that the kernel moves the pages instead of
+ * copying them. This requires _GNU_SOURCE to be defined before any inclusion,
+ * and can be turned off by defining GSTACK_NO_MREMAP.
+ *
+ * To choose the storage of every stack at creation with gstack_create_with(),
+ * do this:
+ *   #define GSTACK_BACKENDS
+ * before including "gstack.h". Without it, every stack is contiguous and no
+ * call goes through the backend table.
+ *
+ * To keep a registry of all the live stacks, so that their spare capacity can
+ * be trimmed at once with gstack_trim_all(), do this:
+ *   #define GSTACK_REGISTRY
+ * before including "gstack.h". It requires C11 atomics. The stacks inside a
+ * gstack_sync, a gstack_durable and the like are left out of it.
+ *
+ * To be able to record how the depth of a stack evolves over time, with
+ * gstack_sample_start(), do this:
+ *   #define GSTACK_SAMPLING
+ * before including "gstack.h".
+ *
+ * To time every change of capacity, and keep histograms of the times and of
+ * the bytes moved, do this:
+ *   #define GSTACK_HISTOGRAMS
+ * before including "gstack.h". It requires C11 atomics.
+ *
+ * To cap the bytes held by groups of stacks, with gstack_budget_create(), do
+ * this:
+ *   #define GSTACK_BUDGETS
+ * before including "gstack.h". It requires C11 atomics.
+ *
+ * To be able to remove elements from anywhere in a stack, with
+ * gstack_remove_at() and gstack_remove_if(), do this:
+ *   #define GSTACK_TOMBSTONES
+ * before including "gstack.h". The removed elements are marked in a bitmap,
+ * which every pop checks.
+ *
+ * To let push, pop, peek, size and is_empty inline into every caller, without
+ * LTO, do this:
+ *   #define GSTACK_INLINE
+ * before including "gstack.h", in any translation unit. It exposes the layout
+ * of a gstack, and turns these functions into macros over inline fast paths,
+ * which call the out-of-line functions on growth, shrinkage, transactions and
+ * the like. The out-of-line functions keep their names, so translation units
+ * with and without GSTACK_INLINE can be mixed, provided that they agree on the
+ * other options.
+ *
+ * To be able to keep a stack in a crash-safe log, with gstack_durable_open(), do
+ * this:
+ *   #define GSTACK_DURABLE
+ * before including "gstack.h". It requires POSIX.1-2001.
+ *
+ * To place USDT probes for perf, bpftrace and the like, do this:
+ *   #define GSTACK_USDT
+ * before including "gstack.h". The probes are gstack:create, gstack:destroy,
+ * gstack:grow and gstack:shrink, with the stack, its old capacity, its new
+ * capacity and its element size as arguments (the old and the new capacity are
+ * the same for create and destroy). They cost a nop each until traced, and are
+ * compiled out if <sys/sdt.h> is not available.
  * 
  * Note: The implementation uses a `void *` to store the objects. Function pointers
  *       may not be compatible with `void *`s according to clause 8 of ISO C Standard
@@ -44,14 +107,25 @@
     #define ATTRIB_NONNULL(...)             __attribute__((nonnull(__VA_ARGS__)))
     #define ATTRIB_WARN_UNUSED_RESULT       __attribute__((warn_unused_result))
     #define ATTRIB_MALLOC                   __attribute__((malloc))
+    #define ATTRIB_COLD                     __attribute__((cold, noinline))
 #else
     #define ATTRIB_NONNULL(...)             /* If only. */
     #define ATTRIB_WARN_UNUSED_RESULT       /* If only. */
     #define ATTRIB_MALLOC(...)              /* If only. */
+    #define ATTRIB_COLD                     /* If only. */
 #endif                          /* defined(__GNUC__) || defined(__clang__) defined(__INTEL_LLVM_COMPILER) */
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#ifdef GSTACK_SAMPLING
+    #include <stdio.h>
+#endif
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+    #define GSTACK_HAS_ATOMICS
+#endif
 
 typedef struct gstack gstack;
 
@@ -97,6 +171,82 @@ GSTACK_DEF void *gstack_pop(gstack *s) ATTRIB_NONNULL(1);
  */
 GSTACK_DEF const void *gstack_peek(const gstack *s) ATTRIB_NONNULL(1);
 
+/*
+ * Typed variants of gstack_push(), gstack_pop(), and gstack_peek() for the
+ * common scalar types, which pass and return the elements by value. For each
+ * NAME and TYPE in GSTACK_TYPES:
+ *
+ *   bool gstack_push_NAME(gstack *s, TYPE value);
+ *   TYPE gstack_pop_NAME(gstack *s);
+ *   TYPE gstack_peek_NAME(const gstack *s);
+ *
+ * As the size of the element is known at compile-time, they copy it with a
+ * single load or store. They can be mixed freely with the `void *` API. With
+ * GSTACK_INLINE, they are macros over inline fast paths as well.
+ *
+ * gstack_push_NAME() fails if the stack was not created with a `memb_size` of
+ * sizeof (TYPE), and gstack_pop_NAME() and gstack_peek_NAME() then return 0
+ * and leave the stack untouched. They also return 0 on an empty stack, so
+ * check with gstack_is_empty() first if 0 is a valid element.
+ *
+ * With C11, the macros GSTACK_PUSH(s, value), GSTACK_POP(s, T), and
+ * GSTACK_PEEK(s, T) select the right variant from the type of `value` or `T`.
+ * Note that the type of a character constant is int. Pointers must be cast to
+ * `void *`. Other types are rejected at compile-time.
+ */
+#define GSTACK_TYPES(X)                     \
+    X(char,     char)                       \
+    X(schar,    signed char)                \
+    X(uchar,    unsigned char)              \
+    X(short,    short)                      \
+    X(ushort,   unsigned short)             \
+    X(int,      int)                        \
+    X(uint,     unsigned int)               \
+    X(long,     long)                       \
+    X(ulong,    unsigned long)              \
+    X(llong,    long long)                  \
+    X(ullong,   unsigned long long)         \
+    X(float,    float)                      \
+    X(double,   double)                     \
+    X(ptr,      void *)
+
+#define GSTACK_DECLARE_TYPED(name, type)                                       \
+    GSTACK_DEF bool gstack_push_##name(gstack *s, type value)                  \
+        ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT;                           \
+    GSTACK_DEF type gstack_pop_##name(gstack *s) ATTRIB_NONNULL(1);            \
+    GSTACK_DEF type gstack_peek_##name(const gstack *s) ATTRIB_NONNULL(1);
+
+GSTACK_TYPES(GSTACK_DECLARE_TYPED)
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+    #ifdef GSTACK_INLINE
+        #define GSTACK_TYPED_NAME(op, name)     op##_##name##_inline
+    #else
+        #define GSTACK_TYPED_NAME(op, name)     op##_##name
+    #endif
+
+    #define GSTACK_TYPED_SELECT(op, x)                              \
+        _Generic((x),                                               \
+            char:               GSTACK_TYPED_NAME(op, char),        \
+            signed char:        GSTACK_TYPED_NAME(op, schar),       \
+            unsigned char:      GSTACK_TYPED_NAME(op, uchar),       \
+            short:              GSTACK_TYPED_NAME(op, short),       \
+            unsigned short:     GSTACK_TYPED_NAME(op, ushort),      \
+            int:                GSTACK_TYPED_NAME(op, int),         \
+            unsigned int:       GSTACK_TYPED_NAME(op, uint),        \
+            long:               GSTACK_TYPED_NAME(op, long),        \
+            unsigned long:      GSTACK_TYPED_NAME(op, ulong),       \
+            long long:          GSTACK_TYPED_NAME(op, llong),       \
+            unsigned long long: GSTACK_TYPED_NAME(op, ullong),      \
+            float:              GSTACK_TYPED_NAME(op, float),       \
+            double:             GSTACK_TYPED_NAME(op, double),      \
+            void *:             GSTACK_TYPED_NAME(op, ptr))
+
+    #define GSTACK_PUSH(s, value)   GSTACK_TYPED_SELECT(gstack_push, (value))((s), (value))
+    #define GSTACK_POP(s, T)        GSTACK_TYPED_SELECT(gstack_pop, (T) 0)(s)
+    #define GSTACK_PEEK(s, T)       GSTACK_TYPED_SELECT(gstack_peek, (T) 0)(s)
+#endif                          /* __STDC_VERSION__ >= 201112L */
+
 /*
  * Returns true if the capacity of the stack referenced by `s` is full, or false
  * elsewise.
@@ -115,186 +265,7183 @@ GSTACK_DEF bool gstack_is_empty(const gstack *s) ATTRIB_NONNULL(1);
 GSTACK_DEF size_t gstack_size(const gstack *s) ATTRIB_NONNULL(1);
 
 /*
- * Destroys and frees all memory associated with the stack referenced by `s`.
+ * Returns the count of elements the stack referenced by `s` can hold before it
+ * has to grow.
  */
-GSTACK_DEF void gstack_destroy(gstack *s) ATTRIB_NONNULL(1);
+GSTACK_DEF size_t gstack_capacity(const gstack *s) ATTRIB_NONNULL(1);
 
-#endif                          /* GSTACK_H */
+/*
+ * Ensures that `n` more elements can be pushed onto the stack referenced by `s`
+ * without it having to grow.
+ *
+ * On a memory allocation failure, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_reserve(gstack *s, size_t n)
+    ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT;
 
-#ifdef GSTACK_IMPLEMENTATION
+/*
+ * Returns a pointer to the element at position `i` of the stack referenced by
+ * `s`, counting from the bottom, or NULL if there are not that many elements.
+ */
+GSTACK_DEF void *gstack_at(const gstack *s, size_t i) ATTRIB_NONNULL(1);
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdint.h>
+/*
+ * Calls `fn` with every element of the stack referenced by `s`, from the bottom
+ * to the top, and `ctx`, until it returns false. The stack must not be modified
+ * by `fn`.
+ *
+ * Returns false if `fn` stopped the iteration, or true elsewise.
+ */
+GSTACK_DEF bool gstack_iterate(const gstack *s, bool (*fn)(const void *elem, void *ctx), void *ctx)
+    ATTRIB_NONNULL(1, 2);
 
-#if defined(GSTACK_MALLOC) != defined(GSTACK_REALLOC) || defined(GSTACK_REALLOC) != defined(GSTACK_FREE)
-    #error  "Must define all or none of GSTACK_MALLOC, GSTACK_REALLOC, and GSTACK_FREE."
-#endif
+#if defined(__unix__) || defined(__APPLE__)
+/*
+ * Reads up to `max_elems` elements from the file descriptor `fd` and pushes
+ * them onto the stack referenced by `s`, in order. The bytes are read straight
+ * into the storage of the stack, which grows as need be.
+ *
+ * It stops at the end of the file, on a read error, or when the stack cannot
+ * grow, and discards the bytes of an element read in part. A read interrupted
+ * by a signal is retried. To tell these apart, set errno to 0 beforehand: it is
+ * still 0 at the end of the file, set by read() on a read error, and ENOMEM
+ * when the stack cannot grow.
+ *
+ * Returns the count of elements pushed.
+ */
+GSTACK_DEF size_t gstack_push_from_fd(gstack *s, int fd, size_t max_elems) ATTRIB_NONNULL(1);
 
-#ifndef GSTACK_MALLOC
-    #define GSTACK_MALLOC(sz)       malloc(sz)
-    #define GSTACK_REALLOC(p, sz)   realloc(p, sz)
-    #define GSTACK_FREE(p)          free(p)
+/*
+ * Writes every element of the stack referenced by `s` to the file descriptor
+ * `fd`, from the bottom to the top, with as few writev() calls as the layout of
+ * the storage allows.
+ *
+ * On a write error, it returns false, and some of the elements may have been
+ * written. Else it returns true.
+ */
+GSTACK_DEF bool gstack_write_to_fd(const gstack *s, int fd) ATTRIB_NONNULL(1);
 #endif
 
-struct gstack {
-    void *data;
-    size_t size;
-    size_t cap;
-    size_t memb_size;
-};
-
-GSTACK_DEF bool gstack_is_full(const gstack *s)
-{
-    return s->size == s->cap;
-}
+#ifdef GSTACK_BACKENDS
+/*
+ * The storage backends a stack can be created with. All of them support the
+ * whole API.
+ *
+ *   GSTACK_CONTIGUOUS  A single buffer, reallocated as the stack grows and
+ *                      shrinks. What gstack_create() uses.
+ *   GSTACK_SEGMENTED   Segments of doubling size that are never moved, so the
+ *                      elements keep their address for as long as they are on
+ *                      the stack, and growth copies nothing.
+ *   GSTACK_RESERVED    A single range of address space reserved up front, into
+ *                      which pages are committed as the stack grows. Elements
+ *                      are never moved. `opts` may point to a size_t holding
+ *                      the maximum count of elements. (POSIX only.)
+ *   GSTACK_FILE        A shared mapping of a file, grown with the file. `opts`
+ *                      may be the path of the file, or NULL for an anonymous
+ *                      temporary file. Its contents are not preserved across
+ *                      runs. (POSIX only.)
+ *   GSTACK_BOUNDED     A single buffer of exactly `cap` elements that is never
+ *                      reallocated. Pushing onto a full stack fails.
+ *   GSTACK_INDIRECT    For elements of a few KiB. Every position is bound to a
+ *                      block carved out of slabs, and only the array of block
+ *                      pointers is reallocated, so growth copies 8 bytes per
+ *                      element and the elements are never moved. Blocks freed
+ *                      by shrinking are reused newest first. Slabs are only
+ *                      released when the stack is destroyed.
+ */
+typedef enum gstack_backend {
+    GSTACK_CONTIGUOUS,
+    GSTACK_SEGMENTED,
+    GSTACK_RESERVED,
+    GSTACK_FILE,
+    GSTACK_BOUNDED,
+    GSTACK_INDIRECT,
+    GSTACK_BACKEND_COUNT
+} gstack_backend;
 
-GSTACK_DEF bool gstack_is_empty(const gstack *s)
-{
-    return s->size == 0;
-}
+/*
+ * Like gstack_create(), but stores the elements with `backend`. The meaning of
+ * `opts` depends on the backend, and it can always be NULL.
+ *
+ * Returns a pointer to the stack on success, or NULL on failure to allocate
+ * memory, or if the backend is not available on this platform.
+ */
+GSTACK_DEF gstack *gstack_create_with(size_t cap, size_t memb_size, gstack_backend backend,
+                                      const void *opts)
+    ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
 
-GSTACK_DEF const void *gstack_peek(const gstack *s)
-{
-    if (gstack_is_empty(s)) {
-        return NULL;
-    }
+/*
+ * Returns the backend of the stack referenced by `s`.
+ */
+GSTACK_DEF gstack_backend gstack_backend_of(const gstack *s) ATTRIB_NONNULL(1);
 
-    return (char *) s->data + (s->size - 1) * s->memb_size;
-}
+/*
+ * Returns a short lowercase name for `backend`, e.g. "segmented".
+ */
+GSTACK_DEF const char *gstack_backend_name(gstack_backend backend);
+#endif                          /* GSTACK_BACKENDS */
 
-GSTACK_DEF gstack *gstack_create(size_t cap, size_t memb_size)
-{
-    if (cap == 0 || memb_size == 0 || cap > SIZE_MAX / memb_size) {
-        return NULL;
-    }
+/*
+ * Destroys and frees all memory associated with the stack referenced by `s`.
+ */
+GSTACK_DEF void gstack_destroy(gstack *s) ATTRIB_NONNULL(1);
 
-    gstack *const s = GSTACK_MALLOC(sizeof *s);
+/*
+ * Shrinks the capacity of the stack referenced by `s` so that it holds at most
+ * `max_slack_ratio` times its count of elements in spare capacity (and room for
+ * at least one element). A ratio of 0 shrinks it to fit.
+ *
+ * It does nothing if a transaction is open on the stack.
+ *
+ * Returns the count of bytes released, which is 0 if the stack had little
+ * enough spare capacity, or if the memory could not be reallocated. A
+ * GSTACK_INDIRECT stack keeps its spare blocks until it is destroyed, so only
+ * its table of blocks shrinks.
+ */
+GSTACK_DEF size_t gstack_trim(gstack *s, double max_slack_ratio) ATTRIB_NONNULL(1);
 
-    if (s) {
-        s->data = GSTACK_MALLOC(memb_size * cap);
+#ifdef GSTACK_REGISTRY
+/*
+ * Calls gstack_trim() on every live stack that has not been pushed onto or
+ * popped from since the previous call, and returns the total count of bytes
+ * released. Hot stacks are left alone, so the first call after a stack is
+ * created or used does not touch it.
+ *
+ * The registry itself can be updated by several threads at once, but the stacks
+ * are not synchronized. This must only be called whilst no other thread is
+ * operating on a registered stack, its destruction included. The registry is
+ * only locked whilst the stacks are listed, not whilst they are trimmed.
+ *
+ * On a memory allocation failure, it returns 0.
+ */
+GSTACK_DEF size_t gstack_trim_all(double max_slack_ratio);
 
-        if (s->data) {
-            s->size = 0;
-            s->cap = cap;
-            s->memb_size = memb_size;
-        } else {
-            free(s);
-            return NULL;
-        }
-    }
+/*
+ * Returns the resident set size of the process in bytes, as read from
+ * /proc/self/statm, or 0 if it could not be determined.
+ */
+GSTACK_DEF size_t gstack_rss(void);
 
-    return s;
-}
+/*
+ * Calls gstack_trim_all() if the resident set size of the process exceeds
+ * `threshold` bytes. Meant to be called periodically from a point where
+ * gstack_trim_all() would be safe to call, such as an event loop.
+ *
+ * Returns the total count of bytes released.
+ */
+GSTACK_DEF size_t gstack_trim_if_rss_above(size_t threshold, double max_slack_ratio);
 
-GSTACK_DEF bool gstack_push(gstack *s, const void *data)
-{
-    if (s->size >= s->cap) {
-        const bool cond = s->cap > SIZE_MAX / 2;
+/*
+ * Labels the stack referenced by `s` in the metrics, where stacks with the same
+ * label are summed up together. Unlabeled stacks are summed up without one.
+ * Meant to be called right after the stack is created.
+ *
+ * The label is not copied. It must remain valid for as long as the stack.
+ */
+GSTACK_DEF void gstack_set_label(gstack *s, const char *label) ATTRIB_NONNULL(1);
 
-        if (cond) {
-            return false;
-        }
-        
-        s->cap *= 2;
+/*
+ * Renders the metrics of all the live stacks in the Prometheus text format to
+ * `buf`, truncated to `len` bytes including the terminating null byte, as with
+ * snprintf(). They are, per label:
+ *
+ *   gstack_stacks         the count of live stacks,
+ *   gstack_bytes_used     the bytes held by their elements,
+ *   gstack_bytes_slack    the bytes their storage holds beyond that,
+ *
+ * and, for the whole process, gstack_grows_total and gstack_shrinks_total,
+ * the counts of changes of capacity since it started.
+ *
+ * As with gstack_trim_all(), the stacks are not synchronized. This must only be
+ * called whilst no other thread is operating on a registered stack, its
+ * destruction included.
+ *
+ * Returns the length of the whole text, not counting the null byte, or 0 on
+ * failure to allocate memory.
+ */
+GSTACK_DEF size_t gstack_metrics_render(char *buf, size_t len);
 
-        if (s->cap > SIZE_MAX / s->memb_size) {
-            return false;
-        }
+#if defined(__unix__) || defined(__APPLE__)
+/*
+ * Like gstack_metrics_render(), but writes the whole text to the file
+ * descriptor `fd`.
+ *
+ * On a memory allocation failure or a write error, it returns false. Else it
+ * returns true.
+ */
+GSTACK_DEF bool gstack_metrics_write(int fd);
+#endif
+#endif                          /* GSTACK_REGISTRY */
 
-        void *const tmp = GSTACK_REALLOC(s->data, s->cap * s->memb_size);
+/*
+ * Returns a mark for the stack referenced by `s`, which can later be passed to
+ * gstack_rewind() to discard every element pushed after it was taken.
+ *
+ * A mark is simply the count of elements at the time of the call, so taking
+ * one costs nothing and they need not be released.
+ */
+GSTACK_DEF size_t gstack_mark(const gstack *s) ATTRIB_NONNULL(1);
 
-        if (!tmp) {
-            return false;
-        }
+/*
+ * Discards every element pushed onto the stack referenced by `s` since `mark`
+ * was taken with gstack_mark(). The capacity is left untouched.
+ *
+ * Returns false if `mark` lies above the current count of elements, i.e. the
+ * elements it refers to have already been popped, or true elsewise.
+ */
+GSTACK_DEF bool gstack_rewind(gstack *s, size_t mark) ATTRIB_NONNULL(1);
 
-        s->data = tmp;
-    } 
+/*
+ * Begins a transaction on the stack referenced by `s`. Every push, pop, and
+ * rewind made until the matching gstack_txn_commit() or gstack_txn_abort() can
+ * then be undone at once.
+ *
+ * Popping an element does not destroy it, so only the elements that existed
+ * at the beginning of the transaction and are overwritten by a later push are
+ * copied aside, the first time they are overwritten. An abort thus costs time
+ * proportional to the count of elements that were changed, and a commit costs
+ * constant time.
+ *
+ * Whilst a transaction is open, gstack_pop() does not shrink the stack.
+ *
+ * Transactions do not nest. Returns false if a transaction is already open on
+ * the stack, or true elsewise.
+ */
+GSTACK_DEF bool gstack_txn_begin(gstack *s) ATTRIB_NONNULL(1);
 
-    char *const target = (char *) s->data + (s->size * s->memb_size);
+/*
+ * Commits the open transaction of the stack referenced by `s`, keeping all the
+ * changes made since gstack_txn_begin().
+ *
+ * Returns false if no transaction is open, or true elsewise.
+ */
+GSTACK_DEF bool gstack_txn_commit(gstack *s) ATTRIB_NONNULL(1);
 
-    memcpy(target, data, s->memb_size);
-    return ++s->size;
-}
+/*
+ * Aborts the open transaction of the stack referenced by `s`, restoring the
+ * elements and the count of elements it had at gstack_txn_begin().
+ *
+ * Returns false if no transaction is open, or true elsewise.
+ */
+GSTACK_DEF bool gstack_txn_abort(gstack *s) ATTRIB_NONNULL(1);
 
-GSTACK_DEF void *gstack_pop(gstack *s)
-{
-    if (gstack_is_empty(s)) {
-        return NULL;
-    }
+#ifdef GSTACK_TOMBSTONES
+/*
+ * Removing an element below the top marks it as a tombstone, which stays in
+ * place until it is popped past or compacted away. A pop skips the tombstones
+ * it uncovers, so that the top is never one, and gstack_peek() and
+ * gstack_is_empty() need not know about them. gstack_at() returns NULL for a
+ * tombstone, and gstack_iterate() skips them. gstack_size() and gstack_mark()
+ * count them, however.
+ *
+ * Once the tombstones exceed GSTACK_TOMBSTONE_RATIO of the elements (a quarter
+ * unless defined), the next removal compacts the stack: the elements left are
+ * moved down in runs, keeping their order, which changes their positions.
+ * gstack_txn_begin() compacts the stack as well, and no element can be removed
+ * whilst a transaction is open.
+ */
+#ifndef GSTACK_TOMBSTONE_RATIO
+    #define GSTACK_TOMBSTONE_RATIO  0.25
+#endif
 
-    --s->size;
-        
-    /* Half the array size if it is too large, or when it is less than one-fourth
-     * the array size. This is the approach CLRS suggests. 
-     */
-    if (s->size && (s->size <= s->cap / 4)) {
-        const size_t new_cap = s->cap / 2;
+/*
+ * Removes the element at position `i` of the stack referenced by `s`, counting
+ * from the bottom.
+ *
+ * If `i` is out of bounds or already removed, during a transaction, or on a
+ * memory allocation failure, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_remove_at(gstack *s, size_t i) ATTRIB_NONNULL(1);
 
-        if (s->cap % 2) {
-            s->cap += 1;
-        }
-        void *const tmp = realloc(s->data, s->memb_size * new_cap); 
+/*
+ * Removes every element of the stack referenced by `s` for which `pred`
+ * returns true, called with the element and `ctx`. `pred` must not modify the
+ * stack.
+ *
+ * Returns the count of elements removed, or 0 during a transaction or on a
+ * memory allocation failure.
+ */
+GSTACK_DEF size_t gstack_remove_if(gstack *s, bool (*pred)(const void *elem, void *ctx), void *ctx)
+    ATTRIB_NONNULL(1, 2);
 
-        if (tmp) {
-            s->data = tmp;
-            s->cap = new_cap;
-        } 
-        /* Else do nothing. The original memory is left intact. */
-    }
-    
-    return (char *) s->data + (s->size * s->memb_size);
-}
+/*
+ * Returns the count of tombstones in the stack referenced by `s`.
+ */
+GSTACK_DEF size_t gstack_tombstones(const gstack *s) ATTRIB_NONNULL(1);
 
-GSTACK_DEF void gstack_destroy(gstack *s)
-{
-    GSTACK_FREE(s->data);
-    GSTACK_FREE(s);
-}
+/*
+ * Compacts the tombstones of the stack referenced by `s` away now.
+ */
+GSTACK_DEF void gstack_compact(gstack *s) ATTRIB_NONNULL(1);
+#endif                          /* GSTACK_TOMBSTONES */
 
-GSTACK_DEF size_t gstack_size(const gstack *s)
-{
-    return s->size;
-}
+#ifdef GSTACK_SAMPLING
+typedef enum gstack_sample_event {
+    GSTACK_SAMPLE_OP,           /* Every Nth push or pop. */
+    GSTACK_SAMPLE_GROW,
+    GSTACK_SAMPLE_SHRINK
+} gstack_sample_event;
 
-#undef ATTRIB_NONNULL
-#undef ATTRIB_WARN_UNUSED_RESULT       
-#undef ATTRIB_MALLOC                   
+typedef struct gstack_sample {
+    uint64_t ns;                /* Since gstack_sample_start(). */
+    size_t size;
+    size_t cap;
+    gstack_sample_event event;
+} gstack_sample;
 
-#endif                          /* GSTACK_IMPLEMENTATION */
+/*
+ * Starts recording samples of the count of elements and the capacity of the
+ * stack referenced by `s`: one every `every` pushes and pops (or none if 0),
+ * and one on every change of capacity. The newest `ring_len` samples are kept.
+ *
+ * Restarting discards the samples recorded so far.
+ *
+ * On a memory allocation failure, or if `ring_len` is 0, it returns false.
+ * Else it returns true.
+ */
+GSTACK_DEF bool gstack_sample_start(gstack *s, size_t ring_len, size_t every)
+    ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT;
 
-#ifdef TEST_MAIN
+/*
+ * Stops recording samples of the stack referenced by `s`, and discards them.
+ */
+GSTACK_DEF void gstack_sample_stop(gstack *s) ATTRIB_NONNULL(1);
 
-#include <assert.h>
-#include <stdint.h>
+/*
+ * Copies up to `max` of the newest samples of the stack referenced by `s` to
+ * `out`, oldest first, and returns how many were copied. If `out` is NULL,
+ * returns how many are kept instead.
+ */
+GSTACK_DEF size_t gstack_samples(const gstack *s, gstack_sample *out, size_t max)
+    ATTRIB_NONNULL(1);
 
-int main(void)
-{
-    gstack *stack = gstack_create(SIZE_MAX - 1000, sizeof (size_t));
-    assert(!stack);
-    
-    stack = gstack_create(10000, sizeof (size_t));
-    assert(stack);
-    assert(!gstack_is_full(stack));
+/*
+ * Writes the samples of the stack referenced by `s` to `out` as CSV, oldest
+ * first, with a header line of "ns,size,cap,event".
+ *
+ * On a write error, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_sample_export(const gstack *s, FILE *out) ATTRIB_NONNULL(1, 2);
+#endif                          /* GSTACK_SAMPLING */
 
-    for (size_t i = 0; i < 200000; ++i) {
-        assert(gstack_push(stack, &i));
-    }
-    
-    assert(!gstack_is_empty(stack));
-    assert(gstack_size(stack) == 200000);
-    assert(*(size_t *) gstack_peek(stack) == 199999);
+/*
+ * A scoped symbol table built on top of a gstack.
+ *
+ * Every binding is pushed onto a single log, and a hash index maps each name
+ * to its newest binding, which in turn records the binding it shadows. Entering
+ * a scope takes a mark of the log, and leaving it rewinds the log back to the
+ * mark after restoring the shadowed bindings in the index. No memory is
+ * allocated per scope.
+ *
+ * The names are not copied. They must remain valid for as long as they are
+ * bound.
+ */
+typedef struct gstack_symtab gstack_symtab;
 
-    for (size_t i = 199999; i < SIZE_MAX; i--) {
-        assert(*(size_t *) gstack_peek(stack) == i);
-        assert(*(size_t *) gstack_pop(stack) == i);
-    }
+/*
+ * Creates a symbol table with room for `cap` bindings, in a global scope.
+ *
+ * Returns a pointer to the table on success, or NULL on failure to allocate
+ * memory.
+ */
+GSTACK_DEF gstack_symtab *gstack_symtab_create(size_t cap)
+    ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
 
-    assert(gstack_is_empty(stack));
-    assert(gstack_size(stack) == 0);
-    gstack_destroy(stack);
-    return EXIT_SUCCESS;
-}
+/*
+ * Binds `name` to `value` in the innermost scope of the table referenced by
+ * `t`, shadowing any binding of `name` in an enclosing scope (or an earlier
+ * one in the same scope) until the scope is left.
+ *
+ * On a memory allocation failure, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_symtab_bind(gstack_symtab *t, const char *name, void *value)
+    ATTRIB_NONNULL(1, 2) ATTRIB_WARN_UNUSED_RESULT;
+
+/*
+ * Returns the value of the newest binding of `name` in the table referenced by
+ * `t`, or NULL if `name` is not bound.
+ *
+ * Note that a NULL value can not be told apart from an unbound name.
+ */
+GSTACK_DEF void *gstack_symtab_lookup(const gstack_symtab *t, const char *name)
+    ATTRIB_NONNULL(1, 2);
+
+/*
+ * Like gstack_symtab_lookup(), but only considers bindings made in the
+ * innermost scope. Useful for detecting redeclarations.
+ */
+GSTACK_DEF void *gstack_symtab_lookup_local(const gstack_symtab *t, const char *name)
+    ATTRIB_NONNULL(1, 2);
+
+/*
+ * Opens a new innermost scope in the table referenced by `t`.
+ *
+ * On a memory allocation failure, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_symtab_enter(gstack_symtab *t)
+    ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT;
+
+/*
+ * Closes the innermost scope of the table referenced by `t`, dropping all of
+ * its bindings and making the ones they shadowed visible again.
+ *
+ * Returns false if only the global scope is open, or true elsewise.
+ */
+GSTACK_DEF bool gstack_symtab_leave(gstack_symtab *t) ATTRIB_NONNULL(1);
+
+/*
+ * Returns the count of open scopes in the table referenced by `t`, not counting
+ * the global scope.
+ */
+GSTACK_DEF size_t gstack_symtab_depth(const gstack_symtab *t) ATTRIB_NONNULL(1);
+
+/*
+ * Destroys and frees all memory associated with the table referenced by `t`.
+ */
+GSTACK_DEF void gstack_symtab_destroy(gstack_symtab *t) ATTRIB_NONNULL(1);
+
+/*
+ * A shadow stack of GC roots: the pointers to heap objects held by the
+ * mutator, which a precise collector must mark and, if it moves objects,
+ * update.
+ *
+ * The roots are kept in one contiguous array, bottom first, so that a
+ * collection scans them as a plain loop over pointers. A function opens a
+ * frame on entry, pushes its roots, and closes the frame on exit, which drops
+ * them all at once.
+ */
+typedef struct gstack_roots gstack_roots;
+
+/*
+ * Creates a shadow stack with room for `cap` roots.
+ *
+ * Returns a pointer to the stack on success, or NULL on failure to allocate
+ * memory.
+ */
+GSTACK_DEF gstack_roots *gstack_roots_create(size_t cap)
+    ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
+
+/*
+ * Opens a frame in the shadow stack referenced by `r`.
+ *
+ * On a memory allocation failure, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_roots_enter(gstack_roots *r) ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT;
+
+/*
+ * Closes the innermost frame of the shadow stack referenced by `r`, dropping
+ * the roots pushed since it was opened.
+ *
+ * Returns false if no frame is open, or true elsewise.
+ */
+GSTACK_DEF bool gstack_roots_leave(gstack_roots *r) ATTRIB_NONNULL(1);
+
+/*
+ * Pushes the root `p`, which may be NULL, onto the shadow stack referenced by
+ * `r`. Its index is the count of roots before the push.
+ *
+ * On a memory allocation failure, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_roots_push(gstack_roots *r, void *p) ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT;
+
+/*
+ * Returns the address of the root at `index` in the shadow stack referenced by
+ * `r`, where the mutator reads it back after a collection and may overwrite
+ * it, or NULL if `index` is out of bounds. It is invalidated by a push, and by
+ * nothing else: gstack_trim_all() does not touch the roots.
+ */
+GSTACK_DEF void **gstack_roots_at(const gstack_roots *r, size_t index) ATTRIB_NONNULL(1);
+
+/*
+ * Returns the array of all the roots in the shadow stack referenced by `r`,
+ * bottom first, and stores their count in `count`. The collector may read and
+ * overwrite them. It is invalidated by a push, and by nothing else:
+ * gstack_trim_all() does not touch the roots.
+ */
+GSTACK_DEF void **gstack_roots_scan(const gstack_roots *r, size_t *count) ATTRIB_NONNULL(1, 2);
+
+/*
+ * Replaces every root in the shadow stack referenced by `r` that is not NULL
+ * with the result of `forward` on it, as a compacting collector does for the
+ * objects it moved. `ctx` is passed to `forward` as is.
+ */
+GSTACK_DEF void gstack_roots_update(gstack_roots *r, void *(*forward)(void *, void *), void *ctx)
+    ATTRIB_NONNULL(1, 2);
+
+/*
+ * Returns the count of roots in the shadow stack referenced by `r`.
+ */
+GSTACK_DEF size_t gstack_roots_size(const gstack_roots *r) ATTRIB_NONNULL(1);
+
+/*
+ * Returns the count of open frames in the shadow stack referenced by `r`.
+ */
+GSTACK_DEF size_t gstack_roots_depth(const gstack_roots *r) ATTRIB_NONNULL(1);
+
+/*
+ * Destroys and frees all memory associated with the shadow stack referenced
+ * by `r`.
+ */
+GSTACK_DEF void gstack_roots_destroy(gstack_roots *r) ATTRIB_NONNULL(1);
+
+/*
+ * A LIFO stack split in up to 64 priority levels, as a scheduler keeps its
+ * runnable tasks: a pop takes the newest element of the highest non-empty
+ * level. A bitmap of the non-empty levels finds it with a single count of
+ * leading zeros, and all the levels share one pool of storage, so that a busy
+ * level reuses what an idle one freed.
+ */
+typedef struct gstack_prio gstack_prio;
+
+#define GSTACK_PRIO_MAX_LEVELS  64
+
+/*
+ * Creates a stack of `levels` priority levels, from 0, the lowest, to
+ * `levels - 1`, for elements of size `memb_size`.
+ *
+ * Returns a pointer to the stack on success, or NULL if `levels` is 0 or
+ * greater than GSTACK_PRIO_MAX_LEVELS, if `memb_size` is 0, or on failure to
+ * allocate memory.
+ */
+GSTACK_DEF gstack_prio *gstack_prio_create(unsigned levels, size_t memb_size)
+    ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
+
+/*
+ * Pushes the element pointed to by `data` onto `level` of the stack referenced
+ * by `p`.
+ *
+ * If `level` is out of bounds, or on a memory allocation failure, it returns
+ * false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_prio_push(gstack_prio *p, unsigned level, const void *data)
+    ATTRIB_NONNULL(1, 3) ATTRIB_WARN_UNUSED_RESULT;
+
+/*
+ * Removes the newest element of the highest non-empty level of the stack
+ * referenced by `p`, copies it to `out`, and stores its level in `level` if not
+ * NULL.
+ *
+ * Returns false if the stack is empty, or true elsewise.
+ */
+GSTACK_DEF bool gstack_prio_pop(gstack_prio *p, void *out, unsigned *level) ATTRIB_NONNULL(1, 2);
+
+/*
+ * Returns a pointer to the element gstack_prio_pop() would remove from the
+ * stack referenced by `p`, and stores its level in `level` if not NULL, or
+ * returns NULL if the stack is empty. It is invalidated by a push.
+ */
+GSTACK_DEF const void *gstack_prio_peek(const gstack_prio *p, unsigned *level) ATTRIB_NONNULL(1);
+
+/*
+ * Returns the count of elements in the stack referenced by `p`.
+ */
+GSTACK_DEF size_t gstack_prio_size(const gstack_prio *p) ATTRIB_NONNULL(1);
+
+/*
+ * Returns the count of elements in `level` of the stack referenced by `p`, or 0
+ * if `level` is out of bounds.
+ */
+GSTACK_DEF size_t gstack_prio_level_size(const gstack_prio *p, unsigned level) ATTRIB_NONNULL(1);
+
+/*
+ * Destroys and frees all memory associated with the stack referenced by `p`.
+ */
+GSTACK_DEF void gstack_prio_destroy(gstack_prio *p) ATTRIB_NONNULL(1);
+
+#ifdef GSTACK_DURABLE
+/*
+ * A stack that survives crashes. Every push and pop is appended to a log as a
+ * checksummed record numbered in sequence, and the records are committed in
+ * groups with a single fdatasync(), so that their cost is shared. The log is
+ * compacted from time to time into a snapshot of the elements, which the log
+ * then continues from.
+ *
+ * Reopening the stack loads the snapshot and replays the log after it. A torn
+ * record at the end of the log, from a crash whilst writing it, is discarded
+ * along with everything after it. Only committed records are sure to be kept.
+ */
+typedef struct gstack_durable gstack_durable;
+
+/*
+ * When to commit a group, whichever comes first, and when to compact. A zero
+ * turns a criterion off.
+ */
+typedef struct gstack_durable_opts {
+    size_t group_count;         /* Records. */
+    size_t group_bytes;         /* Bytes of records. */
+    uint64_t group_ns;          /* Age of the oldest record, checked on every push or pop. */
+    size_t compact_bytes;       /* Compact once the log holds as many bytes. */
+} gstack_durable_opts;
+
+/*
+ * Opens the durable stack of elements of size `memb_size` kept in the log at
+ * `path` and the snapshot at `path` followed by ".snap", creating them if need
+ * be. `opts` may be NULL for groups of 64 records, 1 MiB or 10 ms, and
+ * compaction at 64 MiB.
+ *
+ * Returns a pointer to the stack on success, or NULL on failure to allocate
+ * memory or to open the files, or if the snapshot is corrupt or holds elements
+ * of another size.
+ */
+GSTACK_DEF gstack_durable *gstack_durable_open(const char *path, size_t memb_size,
+                                               const gstack_durable_opts *opts)
+    ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
+
+/*
+ * Pushes the element pointed to by `data` onto the durable stack referenced by
+ * `d`, and stores the sequence number of its record in `seq` if not NULL. It
+ * commits the group if it is due.
+ *
+ * On a memory allocation failure, nothing is pushed and it returns false. If
+ * the commit failed, the element is pushed but its record stays pending, and
+ * it returns false as well. Else it returns true.
+ */
+GSTACK_DEF bool gstack_durable_push(gstack_durable *d, const void *data, uint64_t *seq)
+    ATTRIB_NONNULL(1, 2) ATTRIB_WARN_UNUSED_RESULT;
+
+/*
+ * Removes the topmost element of the durable stack referenced by `d` and copies
+ * it to `out`, and stores the sequence number of its record in `seq` if not
+ * NULL. It commits the group if it is due.
+ *
+ * If the stack is empty, or on a memory allocation failure, nothing is popped
+ * and it returns false. If the commit failed, the element is popped but its
+ * record stays pending, and it returns false as well. Else it returns true.
+ */
+GSTACK_DEF bool gstack_durable_pop(gstack_durable *d, void *out, uint64_t *seq)
+    ATTRIB_NONNULL(1, 2);
+
+/*
+ * Returns a pointer to the topmost element of the durable stack referenced by
+ * `d`, or NULL if it is empty.
+ */
+GSTACK_DEF const void *gstack_durable_peek(const gstack_durable *d) ATTRIB_NONNULL(1);
+
+/*
+ * Returns the count of elements in the durable stack referenced by `d`.
+ */
+GSTACK_DEF size_t gstack_durable_size(const gstack_durable *d) ATTRIB_NONNULL(1);
+
+/*
+ * Returns the sequence number of the newest committed record of the durable
+ * stack referenced by `d`. Every record up to it will survive a crash.
+ */
+GSTACK_DEF uint64_t gstack_durable_committed(const gstack_durable *d) ATTRIB_NONNULL(1);
+
+/*
+ * Commits the pending records of the durable stack referenced by `d` now, and
+ * compacts the log if it is due.
+ *
+ * On a write or sync error, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_durable_commit(gstack_durable *d) ATTRIB_NONNULL(1);
+
+/*
+ * Makes sure that the record numbered `seq` of the durable stack referenced by
+ * `d` is committed, committing now if need be.
+ *
+ * On a write or sync error, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_durable_wait(gstack_durable *d, uint64_t seq) ATTRIB_NONNULL(1);
+
+/*
+ * Commits the pending records of the durable stack referenced by `d`, writes a
+ * new snapshot of its elements, and empties the log.
+ *
+ * On a write or sync error, it returns false, and the previous snapshot and the
+ * log are left valid. Else it returns true.
+ */
+GSTACK_DEF bool gstack_durable_compact(gstack_durable *d) ATTRIB_NONNULL(1);
+
+/*
+ * Commits the pending records of the durable stack referenced by `d`, and
+ * frees all memory associated with it.
+ *
+ * On a write or sync error, it returns false, and the pending records are lost.
+ * Else it returns true.
+ */
+GSTACK_DEF bool gstack_durable_close(gstack_durable *d) ATTRIB_NONNULL(1);
+#endif                          /* GSTACK_DURABLE */
+
+/*
+ * A histogram of 64-bit values, such as durations in nanoseconds, with
+ * log-linear buckets as in HdrHistogram: values under 8 have a bucket each,
+ * and every power of two above is split in 8 buckets, so that a value is
+ * known to within 12.5% regardless of its magnitude.
+ *
+ * A zeroed histogram is empty.
+ */
+#define GSTACK_HIST_SUB_BITS    3
+#define GSTACK_HIST_BUCKETS     ((64 - GSTACK_HIST_SUB_BITS + 1) << GSTACK_HIST_SUB_BITS)
+
+typedef struct gstack_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[GSTACK_HIST_BUCKETS];
+} gstack_hist;
+
+/*
+ * Records `value` in the histogram referenced by `h`.
+ */
+GSTACK_DEF void gstack_hist_record(gstack_hist *h, uint64_t value) ATTRIB_NONNULL(1);
+
+/*
+ * Returns an upper bound of the value under which lie `pct` percent of the
+ * values recorded in the histogram referenced by `h`, e.g. 99.9 for the
+ * p999, or 0 if it is empty.
+ */
+GSTACK_DEF uint64_t gstack_hist_percentile(const gstack_hist *h, double pct) ATTRIB_NONNULL(1);
+
+#ifdef GSTACK_HISTOGRAMS
+typedef struct gstack_resize_hists {
+    gstack_hist grow_ns;
+    gstack_hist shrink_ns;
+    gstack_hist moved_bytes;    /* Copied, which a remapping or a new segment does not. */
+} gstack_resize_hists;
+
+/*
+ * Turns the histograms of the changes of capacity of the stack referenced by
+ * `s` on or off. They are reset when turned on. Every stack is counted in the
+ * global histograms regardless.
+ *
+ * On a memory allocation failure, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_track_resizes(gstack *s, bool on) ATTRIB_NONNULL(1);
+
+/*
+ * Copies the histograms of the stack referenced by `s` to `out`.
+ *
+ * Returns false if they are off, or true elsewise.
+ */
+GSTACK_DEF bool gstack_resize_hists_of(const gstack *s, gstack_resize_hists *out)
+    ATTRIB_NONNULL(1, 2);
+
+/*
+ * Copies the histograms of all the stacks to `out`. They are updated under a
+ * lock, so this can be called from any thread.
+ */
+GSTACK_DEF void gstack_resize_hists_all(gstack_resize_hists *out) ATTRIB_NONNULL(1);
+
+/*
+ * Resets the histograms of all the stacks.
+ */
+GSTACK_DEF void gstack_resize_hists_reset_all(void);
+#endif                          /* GSTACK_HISTOGRAMS */
+
+#ifdef GSTACK_BUDGETS
+/*
+ * A budget caps the bytes held by a group of stacks, e.g. those of a tenant,
+ * which may live in different threads. Every change of capacity of its stacks
+ * is accounted for atomically, and a growth that would exceed the limit fails,
+ * as if the memory could not be allocated, after a callback had a chance to
+ * make room.
+ *
+ * A stack is counted for the bytes its storage holds: the segment table of a
+ * GSTACK_SEGMENTED stack, and the slabs and table of blocks of a
+ * GSTACK_INDIRECT one, included. A growth is checked against the bytes of its
+ * new positions; if more are allocated, e.g. by rounding up, the excess is
+ * accounted for, but not checked. Bytes are only given back once freed, which
+ * a GSTACK_INDIRECT stack does with its spare blocks when destroyed.
+ */
+typedef struct gstack_budget gstack_budget;
+
+typedef struct gstack_budget_usage {
+    size_t used;                /* Bytes. */
+    size_t limit;
+    size_t peak;                /* The most bytes ever used at once. */
+    size_t failures;            /* Growths refused. */
+    size_t stacks;
+} gstack_budget_usage;
+
+/*
+ * Creates a budget of `limit` bytes. When a growth of `need` bytes of a stack
+ * `s` would exceed it, `on_exceed`, unless NULL, is called with the budget,
+ * `s`, `need`, and `ctx`. It may raise the limit or shrink other stacks, and
+ * returns true for the growth to be tried again, once, or false for it to fail.
+ * It must not shrink `s` itself.
+ *
+ * Returns a pointer to the budget on success, or NULL on failure to allocate
+ * memory.
+ */
+GSTACK_DEF gstack_budget *gstack_budget_create(size_t limit,
+                                               bool (*on_exceed)(gstack_budget *b, gstack *s,
+                                                                 size_t need, void *ctx),
+                                               void *ctx)
+    ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
+
+/*
+ * Sets the limit of the budget referenced by `b`. Lowering it below the bytes
+ * in use only fails the growths to come.
+ */
+GSTACK_DEF void gstack_budget_set_limit(gstack_budget *b, size_t limit) ATTRIB_NONNULL(1);
+
+/*
+ * Makes the stack referenced by `s`, usually just created, join the budget
+ * referenced by `b`, which the bytes it holds are charged to. It stays in it
+ * until it is destroyed.
+ *
+ * Returns false if `s` already belongs to a budget or holds more than what is
+ * left of `b`, or true elsewise.
+ */
+GSTACK_DEF bool gstack_budget_join(gstack *s, gstack_budget *b)
+    ATTRIB_NONNULL(1, 2) ATTRIB_WARN_UNUSED_RESULT;
+
+/*
+ * Returns the budget the stack referenced by `s` belongs to, or NULL.
+ */
+GSTACK_DEF gstack_budget *gstack_budget_of(const gstack *s) ATTRIB_NONNULL(1);
+
+/*
+ * Copies the usage of the budget referenced by `b` to `out`.
+ */
+GSTACK_DEF void gstack_budget_query(const gstack_budget *b, gstack_budget_usage *out)
+    ATTRIB_NONNULL(1, 2);
+
+/*
+ * Destroys and frees all memory associated with the budget referenced by `b`.
+ *
+ * Returns false, leaving it intact, if stacks still belong to it, or true
+ * elsewise.
+ */
+GSTACK_DEF bool gstack_budget_destroy(gstack_budget *b) ATTRIB_NONNULL(1);
+#endif                          /* GSTACK_BUDGETS */
+
+#ifdef GSTACK_HAS_ATOMICS
+/*
+ * A stack synchronized with a lock of its own, for sharing between threads.
+ *
+ * The lock spins with exponential backoff for up to GSTACK_SPIN_LIMIT rounds
+ * (64 unless defined), which is enough for the short critical sections of a
+ * stack, before it parks the thread on a futex on Linux, or yields elsewhere.
+ *
+ * It can keep statistics on how it is used, to help tune GSTACK_SPIN_LIMIT.
+ *
+ * Requires C11 atomics.
+ */
+typedef struct gstack_sync gstack_sync;
+
+typedef struct gstack_lock_stats {
+    uint64_t acquisitions;
+    uint64_t contended;         /* Acquisitions that did not succeed at once. */
+    uint64_t parked;            /* Acquisitions that had to park the thread. */
+    gstack_hist wait_ns;        /* Time taken to acquire the lock. */
+    gstack_hist hold_ns;        /* Time the lock was held for. */
+} gstack_lock_stats;
+
+/*
+ * Creates a synchronized stack with `cap` elements of size `memb_size`, as
+ * with gstack_create(). The statistics are off.
+ *
+ * Returns a pointer to the stack on success, or NULL on failure to allocate
+ * memory.
+ */
+GSTACK_DEF gstack_sync *gstack_sync_create(size_t cap, size_t memb_size)
+    ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
+
+/*
+ * Pushes the element pointed to by `data` onto the stack referenced by `s`.
+ *
+ * On a memory allocation failure, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_sync_push(gstack_sync *s, const void *data)
+    ATTRIB_NONNULL(1, 2) ATTRIB_WARN_UNUSED_RESULT;
+
+/*
+ * Removes the topmost element of the stack referenced by `s` and copies it to
+ * `out`. A pointer into the stack would not outlive the lock.
+ *
+ * If the stack is empty, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_sync_pop(gstack_sync *s, void *out) ATTRIB_NONNULL(1, 2);
+
+/*
+ * Copies the topmost element of the stack referenced by `s` to `out` without
+ * removing it.
+ *
+ * If the stack is empty, it returns false. Else it returns true.
+ */
+GSTACK_DEF bool gstack_sync_peek(gstack_sync *s, void *out) ATTRIB_NONNULL(1, 2);
+
+/*
+ * Returns the count of elements in the stack referenced by `s`.
+ */
+GSTACK_DEF size_t gstack_sync_size(gstack_sync *s) ATTRIB_NONNULL(1);
+
+/*
+ * Turns the lock statistics of the stack referenced by `s` on or off. They are
+ * reset when turned on. Whilst on, every critical section reads the clock
+ * twice, and a contended acquisition once more.
+ */
+GSTACK_DEF void gstack_sync_track(gstack_sync *s, bool on) ATTRIB_NONNULL(1);
+
+/*
+ * Copies the lock statistics of the stack referenced by `s` to `out`.
+ */
+GSTACK_DEF void gstack_sync_stats(gstack_sync *s, gstack_lock_stats *out) ATTRIB_NONNULL(1, 2);
+
+/*
+ * Destroys and frees all memory associated with the stack referenced by `s`,
+ * which no other thread may be using.
+ */
+GSTACK_DEF void gstack_sync_destroy(gstack_sync *s) ATTRIB_NONNULL(1);
+#endif                          /* GSTACK_HAS_ATOMICS */
+
+#endif                          /* GSTACK_H */
+
+/* The layout of a gstack, for the implementation and for the inline fast paths.
+ * It must not depend on anything but the options, which all the translation
+ * units have to agree on.
+ */
+#if (defined(GSTACK_IMPLEMENTATION) || defined(GSTACK_INLINE)) && !defined(GSTACK_STRUCT_DEFINED)
+#define GSTACK_STRUCT_DEFINED
+
+struct gstack {
+    void *data;
+    size_t size;
+    size_t cap;
+    size_t memb_size;
+
+    /* The elements overwritten during a transaction are saved in `undo`, the
+     * one at position p in slot `txn_base - 1 - p`. Only the positions in
+     * [txn_lo, txn_hi) have been saved.
+     */
+    void *undo;
+    size_t undo_cap;
+    size_t txn_base;
+    size_t txn_lo;
+    size_t txn_hi;
+    bool in_txn;
+
+#ifdef __linux__
+    size_t mapped_len;      /* The length of the mapping `data` points to, or 0. */
+#endif
+
+#ifdef GSTACK_BACKENDS
+    const struct gstack_backend_ops *ops;
+    gstack_backend backend;
+    bool contiguous;        /* The elements are laid out from `data`. */
+
+    /* GSTACK_SEGMENTED: log2 of the size of the first segment.
+     * GSTACK_RESERVED, GSTACK_FILE: the length of the mapping.
+     * GSTACK_INDIRECT: the size of a block.
+     */
+    size_t limit;
+    int fd;                 /* GSTACK_FILE: the backing file. */
+#endif
+
+#ifdef GSTACK_REGISTRY
+    gstack *prev;
+    gstack *next;
+    bool touched;           /* Pushed onto or popped from since the last sweep. */
+    bool registered;        /* Or owned by another structure of this library. */
+    const char *label;      /* Or NULL. */
+#endif
+
+#ifdef GSTACK_SAMPLING
+    gstack_sample *samples; /* A ring of `sample_cap` samples, or NULL. */
+    size_t sample_cap;
+    size_t sample_count;    /* All the samples ever recorded. */
+    size_t sample_every;
+    size_t sample_tick;     /* Pushes and pops until the next sample. */
+    uint64_t sample_origin;
+#endif
+
+#ifdef GSTACK_HISTOGRAMS
+    gstack_resize_hists *hists; /* Or NULL if not tracked. */
+    size_t copied;          /* By the latest resize. */
+#endif
+
+#ifdef GSTACK_BUDGETS
+    gstack_budget *budget;  /* Or NULL. */
+#endif
+
+#ifdef GSTACK_TOMBSTONES
+    /* Bit i of `dead` is set iff position i is a tombstone. The bits at and
+     * above `size` are always clear, as are the positions past `dead_words`.
+     */
+    uint64_t *dead;
+    size_t dead_words;
+    size_t dead_count;
+#endif
+};
+
+#ifdef GSTACK_INLINE
+#include <string.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define GSTACK_LIKELY(x)    __builtin_expect(!!(x), 1)
+#else
+    #define GSTACK_LIKELY(x)    (x)
+#endif
+
+/* Whether a push or a pop can skip all the bookkeeping. */
+static inline bool gstack_inline_plain(const gstack *s)
+{
+    return !s->in_txn
+#ifdef GSTACK_BACKENDS
+        && s->contiguous
+#endif
+#ifdef GSTACK_SAMPLING
+        && !s->samples
+#endif
+#ifdef GSTACK_TOMBSTONES
+        && !s->dead_count
+#endif
+        ;
+}
+
+static inline bool gstack_push_inline(gstack *s, const void *data)
+{
+    if (GSTACK_LIKELY(s->size < s->cap && gstack_inline_plain(s))) {
+        memcpy((char *) s->data + s->size++ * s->memb_size, data, s->memb_size);
+#ifdef GSTACK_REGISTRY
+        s->touched = true;
+#endif
+        return true;
+    }
+
+    return (gstack_push)(s, data);
+}
+
+static inline void *gstack_pop_inline(gstack *s)
+{
+    const size_t n = s->size - 1;
+
+    /* Unless the stack is due to shrink, as in gstack_pop(). */
+    if (GSTACK_LIKELY(s->size != 0 && (n == 0 || n > s->cap / 4) && gstack_inline_plain(s))) {
+        s->size = n;
+#ifdef GSTACK_REGISTRY
+        s->touched = true;
+#endif
+        return (char *) s->data + n * s->memb_size;
+    }
+
+    return (gstack_pop)(s);
+}
+
+static inline const void *gstack_peek_inline(const gstack *s)
+{
+#ifdef GSTACK_BACKENDS
+    if (!s->contiguous) {
+        return (gstack_peek)(s);
+    }
+#endif
+    return s->size ? (const char *) s->data + (s->size - 1) * s->memb_size : NULL;
+}
+
+static inline size_t gstack_size_inline(const gstack *s)
+{
+    return s->size;
+}
+
+static inline bool gstack_is_empty_inline(const gstack *s)
+{
+    return s->size == 0;
+}
+
+/* The typed variants, which copy the element with a single load or store. */
+#ifdef GSTACK_REGISTRY
+    #define GSTACK_INLINE_TOUCH(s)  ((void) ((s)->touched = true))
+#else
+    #define GSTACK_INLINE_TOUCH(s)  ((void) 0)
+#endif
+
+#define GSTACK_INLINE_TYPED(name, type)                                         \
+    static inline bool gstack_push_##name##_inline(gstack *s, type value)       \
+    {                                                                           \
+        if (GSTACK_LIKELY(s->size < s->cap && s->memb_size == sizeof value      \
+                          && gstack_inline_plain(s))) {                         \
+            memcpy((char *) s->data + s->size++ * sizeof value, &value,        \
+                   sizeof value);                                               \
+            GSTACK_INLINE_TOUCH(s);                                             \
+            return true;                                                        \
+        }                                                                       \
+                                                                                \
+        return (gstack_push_##name)(s, value);                                  \
+    }                                                                           \
+                                                                                \
+    static inline type gstack_pop_##name##_inline(gstack *s)                    \
+    {                                                                           \
+        const size_t n = s->size - 1;                                           \
+                                                                                \
+        if (GSTACK_LIKELY(s->size != 0 && (n == 0 || n > s->cap / 4)           \
+                          && s->memb_size == sizeof (type)                      \
+                          && gstack_inline_plain(s))) {                         \
+            type value;                                                         \
+                                                                                \
+            s->size = n;                                                        \
+            GSTACK_INLINE_TOUCH(s);                                             \
+            memcpy(&value, (char *) s->data + n * sizeof value, sizeof value);  \
+            return value;                                                       \
+        }                                                                       \
+                                                                                \
+        return (gstack_pop_##name)(s);                                          \
+    }                                                                           \
+                                                                                \
+    static inline type gstack_peek_##name##_inline(const gstack *s)             \
+    {                                                                           \
+        if (GSTACK_LIKELY(s->size != 0 && s->memb_size == sizeof (type)         \
+                          && gstack_inline_plain(s))) {                         \
+            type value;                                                         \
+                                                                                \
+            memcpy(&value, (const char *) s->data + (s->size - 1) * sizeof value, \
+                   sizeof value);                                               \
+            return value;                                                       \
+        }                                                                       \
+                                                                                \
+        return (gstack_peek_##name)(s);                                         \
+    }
+
+GSTACK_TYPES(GSTACK_INLINE_TYPED)
+
+#define gstack_push(s, data)    gstack_push_inline((s), (data))
+#define gstack_pop(s)           gstack_pop_inline(s)
+#define gstack_peek(s)          gstack_peek_inline(s)
+#define gstack_size(s)          gstack_size_inline(s)
+#define gstack_is_empty(s)      gstack_is_empty_inline(s)
+
+#define gstack_push_char(s, v)      gstack_push_char_inline((s), (v))
+#define gstack_push_schar(s, v)     gstack_push_schar_inline((s), (v))
+#define gstack_push_uchar(s, v)     gstack_push_uchar_inline((s), (v))
+#define gstack_push_short(s, v)     gstack_push_short_inline((s), (v))
+#define gstack_push_ushort(s, v)    gstack_push_ushort_inline((s), (v))
+#define gstack_push_int(s, v)       gstack_push_int_inline((s), (v))
+#define gstack_push_uint(s, v)      gstack_push_uint_inline((s), (v))
+#define gstack_push_long(s, v)      gstack_push_long_inline((s), (v))
+#define gstack_push_ulong(s, v)     gstack_push_ulong_inline((s), (v))
+#define gstack_push_llong(s, v)     gstack_push_llong_inline((s), (v))
+#define gstack_push_ullong(s, v)    gstack_push_ullong_inline((s), (v))
+#define gstack_push_float(s, v)     gstack_push_float_inline((s), (v))
+#define gstack_push_double(s, v)    gstack_push_double_inline((s), (v))
+#define gstack_push_ptr(s, v)       gstack_push_ptr_inline((s), (v))
+
+#define gstack_pop_char(s)          gstack_pop_char_inline(s)
+#define gstack_pop_schar(s)         gstack_pop_schar_inline(s)
+#define gstack_pop_uchar(s)         gstack_pop_uchar_inline(s)
+#define gstack_pop_short(s)         gstack_pop_short_inline(s)
+#define gstack_pop_ushort(s)        gstack_pop_ushort_inline(s)
+#define gstack_pop_int(s)           gstack_pop_int_inline(s)
+#define gstack_pop_uint(s)          gstack_pop_uint_inline(s)
+#define gstack_pop_long(s)          gstack_pop_long_inline(s)
+#define gstack_pop_ulong(s)         gstack_pop_ulong_inline(s)
+#define gstack_pop_llong(s)         gstack_pop_llong_inline(s)
+#define gstack_pop_ullong(s)        gstack_pop_ullong_inline(s)
+#define gstack_pop_float(s)         gstack_pop_float_inline(s)
+#define gstack_pop_double(s)        gstack_pop_double_inline(s)
+#define gstack_pop_ptr(s)           gstack_pop_ptr_inline(s)
+
+#define gstack_peek_char(s)         gstack_peek_char_inline(s)
+#define gstack_peek_schar(s)        gstack_peek_schar_inline(s)
+#define gstack_peek_uchar(s)        gstack_peek_uchar_inline(s)
+#define gstack_peek_short(s)        gstack_peek_short_inline(s)
+#define gstack_peek_ushort(s)       gstack_peek_ushort_inline(s)
+#define gstack_peek_int(s)          gstack_peek_int_inline(s)
+#define gstack_peek_uint(s)         gstack_peek_uint_inline(s)
+#define gstack_peek_long(s)         gstack_peek_long_inline(s)
+#define gstack_peek_ulong(s)        gstack_peek_ulong_inline(s)
+#define gstack_peek_llong(s)        gstack_peek_llong_inline(s)
+#define gstack_peek_ullong(s)       gstack_peek_ullong_inline(s)
+#define gstack_peek_float(s)        gstack_peek_float_inline(s)
+#define gstack_peek_double(s)       gstack_peek_double_inline(s)
+#define gstack_peek_ptr(s)          gstack_peek_ptr_inline(s)
+#endif                          /* GSTACK_INLINE */
+#endif                          /* GSTACK_STRUCT_DEFINED */
+
+#ifdef GSTACK_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(GSTACK_MALLOC) != defined(GSTACK_REALLOC) || defined(GSTACK_REALLOC) != defined(GSTACK_FREE)
+    #error  "Must define all or none of GSTACK_MALLOC, GSTACK_REALLOC, and GSTACK_FREE."
+#endif
+
+#ifdef GSTACK_REGISTRY
+    #if !defined(__STDC_VERSION__) || __STDC_VERSION__ < 201112L || defined(__STDC_NO_ATOMICS__)
+        #error  "GSTACK_REGISTRY requires C11 atomics."
+    #endif
+    #include <stdatomic.h>
+    #include <stdarg.h>
+
+    #if defined(__unix__) || defined(__APPLE__)
+        #include <errno.h>
+        #include <unistd.h>
+    #endif
+#endif                          /* GSTACK_REGISTRY */
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <errno.h>
+    #include <sys/uio.h>
+    #include <unistd.h>
+
+    /* The most buffers gstack_write_to_fd() hands to writev() at once. */
+    #define GSTACK_IOV_BATCH        64
+#endif
+
+#if defined(GSTACK_HISTOGRAMS) && !defined(GSTACK_HAS_ATOMICS)
+    #error  "GSTACK_HISTOGRAMS requires C11 atomics."
+#endif
+
+#if defined(GSTACK_BUDGETS) && !defined(GSTACK_HAS_ATOMICS)
+    #error  "GSTACK_BUDGETS requires C11 atomics."
+#endif
+
+#if defined(GSTACK_HAS_ATOMICS) || defined(GSTACK_SAMPLING) || defined(GSTACK_DURABLE)
+    #include <time.h>
+#endif
+
+#ifdef GSTACK_DURABLE
+    #if !defined(__unix__) && !defined(__APPLE__)
+        #error  "GSTACK_DURABLE requires POSIX."
+    #endif
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+
+    #if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200112L
+        #error  "GSTACK_DURABLE requires POSIX.1-2001. Define _POSIX_C_SOURCE as 200112L or later."
+    #endif
+
+    #if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+        #define GSTACK_DATASYNC(fd)     fdatasync(fd)
+    #else
+        #define GSTACK_DATASYNC(fd)     fsync(fd)
+    #endif
+#endif                          /* GSTACK_DURABLE */
+
+#if defined(GSTACK_USDT) && defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define GSTACK_PROBE(name, s, old_cap, new_cap) \
+            DTRACE_PROBE4(gstack, name, s, old_cap, new_cap, (s)->memb_size)
+    #endif
+#endif
+
+#ifndef GSTACK_PROBE
+    #define GSTACK_PROBE(name, s, old_cap, new_cap)     ((void) 0)
+#endif
+
+/* Records the count of bytes a resize copied, for its histograms. */
+#ifdef GSTACK_HISTOGRAMS
+    #define GSTACK_COPIED(s, bytes)     ((void) ((s)->copied = (bytes)))
+#else
+    #define GSTACK_COPIED(s, bytes)     ((void) 0)
+#endif
+
+#ifdef GSTACK_HAS_ATOMICS
+    #include <stdatomic.h>
+
+    #if defined(__linux__) && (defined(_GNU_SOURCE) || defined(_DEFAULT_SOURCE))
+        #include <linux/futex.h>
+        #include <sys/syscall.h>
+        #include <unistd.h>
+
+        #if defined(SYS_futex) && defined(FUTEX_WAIT_PRIVATE)
+            #define GSTACK_HAS_FUTEX
+        #endif
+    #endif
+
+    #if !defined(GSTACK_HAS_FUTEX) && !defined(__STDC_NO_THREADS__)
+        #include <threads.h>
+    #endif
+
+    #if defined(__x86_64__) || defined(__i386__)
+        #include <immintrin.h>
+        #define GSTACK_PAUSE()      _mm_pause()
+    #elif defined(__aarch64__)
+        #define GSTACK_PAUSE()      __asm__ __volatile__("yield")
+    #else
+        #define GSTACK_PAUSE()      ((void) 0)
+    #endif
+
+    /* The rounds of backoff gstack_sync spins for before it parks. */
+    #ifndef GSTACK_SPIN_LIMIT
+        #define GSTACK_SPIN_LIMIT   64
+    #endif
+#endif                          /* GSTACK_HAS_ATOMICS */
+
+#ifndef GSTACK_MALLOC
+    #define GSTACK_MALLOC(sz)       malloc(sz)
+    #define GSTACK_REALLOC(p, sz)   realloc(p, sz)
+    #define GSTACK_FREE(p)          free(p)
+    #define GSTACK_DEFAULT_ALLOCATOR
+#endif
+
+#if defined(GSTACK_DEFAULT_ALLOCATOR) && defined(__GLIBC__)
+    #include <malloc.h>
+    #define GSTACK_HAS_USABLE_SIZE
+#endif
+
+#if defined(GSTACK_DEFAULT_ALLOCATOR) && defined(__linux__) && !defined(GSTACK_NO_MREMAP)
+    #include <sys/mman.h>
+    #include <unistd.h>
+
+    #if defined(MREMAP_MAYMOVE) && defined(MAP_ANONYMOUS)
+        #define GSTACK_HAS_MREMAP
+    #endif
+#endif
+
+#ifndef GSTACK_MMAP_THRESHOLD
+    #define GSTACK_MMAP_THRESHOLD   ((size_t) 1 << 20)
+#endif
+
+#ifdef GSTACK_BACKENDS
+    #include <limits.h>
+
+    #if defined(__unix__) || defined(__APPLE__)
+        #include <fcntl.h>
+        #include <sys/mman.h>
+        #include <unistd.h>
+
+        #if defined(MAP_ANONYMOUS) && defined(MAP_NORESERVE)
+            #define GSTACK_HAS_MMAP
+        #endif
+    #endif
+
+    /* The address space GSTACK_RESERVED reserves when not told otherwise. */
+    #ifndef GSTACK_RESERVE_DEFAULT
+        #define GSTACK_RESERVE_DEFAULT  ((size_t) 1 << (SIZE_MAX > 0xFFFFFFFFu ? 34 : 28))
+    #endif
+#endif                          /* GSTACK_BACKENDS */
+
+#if defined(GSTACK_HAS_ATOMICS) || defined(GSTACK_SAMPLING) || defined(GSTACK_DURABLE)
+static uint64_t gstack_now_ns(void)
+{
+#if defined(CLOCK_MONOTONIC) || defined(TIME_UTC)
+    struct timespec ts;
+
+    #ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    #else
+    timespec_get(&ts, TIME_UTC);
+    #endif
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#else
+    return (uint64_t) ((double) clock() * 1e9 / CLOCKS_PER_SEC);
+#endif
+}
+#endif
+
+#ifdef GSTACK_SAMPLING
+static void gstack_sample_record(gstack *s, gstack_sample_event event)
+{
+    gstack_sample *const sample = &s->samples[s->sample_count++ % s->sample_cap];
+
+    sample->ns = gstack_now_ns() - s->sample_origin;
+    sample->size = s->size;
+    sample->cap = s->cap;
+    sample->event = event;
+}
+
+/* Counts a push or a pop, and samples the stack on every Nth. */
+static void gstack_sample_tick(gstack *s)
+{
+    if (s->samples && s->sample_every && --s->sample_tick == 0) {
+        s->sample_tick = s->sample_every;
+        gstack_sample_record(s, GSTACK_SAMPLE_OP);
+    }
+}
+#endif                          /* GSTACK_SAMPLING */
+
+#ifdef GSTACK_HISTOGRAMS
+static gstack_resize_hists gstack_hists_global;
+static atomic_flag gstack_hists_lock = ATOMIC_FLAG_INIT;
+
+static void gstack_hists_acquire(void)
+{
+    while (atomic_flag_test_and_set_explicit(&gstack_hists_lock, memory_order_acquire)) {
+        ;
+    }
+}
+
+static void gstack_hists_release(void)
+{
+    atomic_flag_clear_explicit(&gstack_hists_lock, memory_order_release);
+}
+
+static void gstack_hists_record(gstack_resize_hists *h, bool grew, uint64_t ns, uint64_t moved)
+{
+    gstack_hist_record(grew ? &h->grow_ns : &h->shrink_ns, ns);
+    gstack_hist_record(&h->moved_bytes, moved);
+}
+#endif                          /* GSTACK_HISTOGRAMS */
+
+#ifdef GSTACK_REGISTRY
+static gstack *gstack_registry;
+static size_t gstack_registry_count;
+static atomic_flag gstack_registry_lock = ATOMIC_FLAG_INIT;
+static atomic_size_t gstack_registry_grows;
+static atomic_size_t gstack_registry_shrinks;
+
+static void gstack_registry_acquire(void)
+{
+    while (atomic_flag_test_and_set_explicit(&gstack_registry_lock, memory_order_acquire)) {
+        ;
+    }
+}
+
+static void gstack_registry_release(void)
+{
+    atomic_flag_clear_explicit(&gstack_registry_lock, memory_order_release);
+}
+
+static void gstack_registry_add(gstack *s)
+{
+    gstack_registry_acquire();
+    s->prev = NULL;
+    s->next = gstack_registry;
+
+    if (gstack_registry) {
+        gstack_registry->prev = s;
+    }
+
+    gstack_registry = s;
+    ++gstack_registry_count;
+    gstack_registry_release();
+}
+
+static void gstack_registry_remove(gstack *s)
+{
+    if (!s->registered) {
+        return;
+    }
+
+    gstack_registry_acquire();
+
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        gstack_registry = s->next;
+    }
+
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+
+    --gstack_registry_count;
+    gstack_registry_release();
+}
+#endif                          /* GSTACK_REGISTRY */
+
+#ifdef GSTACK_HAS_MREMAP
+/* Moves the stack referenced by `s` into a mapping of at least `bytes` bytes,
+ * or resizes the mapping it is already in. Once mapped, a stack stays mapped 
+ * until destroyed, so that shrinking it does not copy either.
+ */
+static bool gstack_resize_mapped(gstack *s, size_t bytes)
+{
+    const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+    if (bytes > SIZE_MAX - page_size) {
+        return false;
+    }
+
+    bytes = (bytes + page_size - 1) / page_size * page_size;
+
+    if (bytes == s->mapped_len) {
+        return true;
+    }
+
+    void *p;
+
+    if (s->mapped_len) {
+        p = mremap(s->data, s->mapped_len, bytes, MREMAP_MAYMOVE);
+    } else {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (p != MAP_FAILED && s->data) {
+            /* This is the last copy the stack ever gets, and only of the live 
+             * elements. 
+             */
+            memcpy(p, s->data, s->size * s->memb_size);
+            GSTACK_COPIED(s, s->size * s->memb_size);
+            GSTACK_FREE(s->data);
+        }
+    }
+
+    if (p == MAP_FAILED) {
+        return false;
+    }
+
+    s->data = p;
+    s->mapped_len = bytes;
+    s->cap = bytes / s->memb_size;
+    return true;
+}
+#endif                          /* GSTACK_HAS_MREMAP */
+
+/* Reallocates the stack referenced by `s` to hold at least `new_cap` elements,
+ * which must not be less than its count of elements. On failure, the stack is
+ * left intact.
+ */
+static bool gstack_contiguous_resize(gstack *s, size_t new_cap)
+{
+    if (new_cap > SIZE_MAX / s->memb_size) {
+        return false;
+    }
+
+#ifdef GSTACK_HAS_MREMAP
+    if (s->mapped_len || new_cap * s->memb_size >= GSTACK_MMAP_THRESHOLD) {
+        return gstack_resize_mapped(s, new_cap * s->memb_size);
+    }
+#endif
+
+    const uintptr_t old = (uintptr_t) s->data;
+    void *const tmp = GSTACK_REALLOC(s->data, new_cap * s->memb_size);
+
+    if (!tmp) {
+        return false;
+    }
+
+    if (old && (uintptr_t) tmp != old) {
+        GSTACK_COPIED(s, s->size * s->memb_size);
+    }
+
+    s->data = tmp;
+
+#ifdef GSTACK_HAS_USABLE_SIZE
+    /* Whatever malloc() rounded the request up to is ours to use. */
+    s->cap = malloc_usable_size(tmp) / s->memb_size;
+#else
+    s->cap = new_cap;
+#endif
+    return true;
+}
+
+static bool gstack_contiguous_init(gstack *s, size_t cap, const void *opts)
+{
+    (void) opts;
+    s->data = NULL;
+#ifdef GSTACK_HAS_MREMAP
+    s->mapped_len = 0;
+#endif
+    return gstack_contiguous_resize(s, cap);
+}
+
+static size_t gstack_contiguous_footprint(const gstack *s)
+{
+#ifdef GSTACK_HAS_MREMAP
+    if (s->mapped_len) {
+        return s->mapped_len;
+    }
+#endif
+    return s->cap * s->memb_size;
+}
+
+static void gstack_contiguous_fini(gstack *s)
+{
+#ifdef GSTACK_HAS_MREMAP
+    if (s->mapped_len) {
+        munmap(s->data, s->mapped_len);
+        return;
+    }
+#endif
+    GSTACK_FREE(s->data);
+}
+
+/* Its size is a multiple of the alignment of any object. */
+union gstack_max_align {
+    long double ld;
+    long long ll;
+    void *p;
+    void (*fn)(void);
+};
+
+#ifdef GSTACK_BACKENDS
+struct gstack_backend_ops {
+    const char *name;
+
+    /* Sets up the storage for at least `cap` elements. */
+    bool (*init)(gstack *s, size_t cap, const void *opts);
+
+    /* Like gstack_contiguous_resize(). It may refuse to shrink. */
+    bool (*resize)(gstack *s, size_t new_cap);
+
+    /* Returns the address of the element at position `i`. NULL if the elements
+     * are laid out contiguously from `data`.
+     */
+    void *(*slot)(const gstack *s, size_t i);
+    void (*fini)(gstack *s);
+
+    /* Returns the count of bytes of memory the storage holds. */
+    size_t (*footprint)(const gstack *s);
+};
+
+/* For the backends that hold exactly their capacity. */
+static size_t gstack_plain_footprint(const gstack *s)
+{
+    return s->cap * s->memb_size;
+}
+
+/* Returns the floor of log2(x), which must not be 0. */
+static unsigned gstack_log2(size_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned) (sizeof (unsigned long long) * CHAR_BIT - 1)
+        - (unsigned) __builtin_clzll((unsigned long long) x);
+#else
+    unsigned n = 0;
+
+    while (x >>= 1) {
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/* GSTACK_SEGMENTED. Segment k holds `1 << (limit + k)` elements, so that the
+ * capacity is always `(2^n - 1) << limit` with n segments. `data` points to the
+ * table of segments.
+ */
+#define GSTACK_MAX_SEGMENTS     (sizeof (size_t) * CHAR_BIT)
+
+static size_t gstack_segment_count(const gstack *s)
+{
+    return gstack_log2((s->cap >> s->limit) + 1);
+}
+
+static void *gstack_segmented_slot(const gstack *s, size_t i)
+{
+    const unsigned k = gstack_log2((i >> s->limit) + 1);
+    const size_t offset = i - ((((size_t) 1 << k) - 1) << s->limit);
+
+    return ((char **) s->data)[k] + offset * s->memb_size;
+}
+
+static bool gstack_segmented_resize(gstack *s, size_t new_cap)
+{
+    char **const segs = s->data;
+    size_t n = gstack_segment_count(s);
+
+    if (new_cap > s->cap) {
+        /* On failure, the segments added so far are kept. */
+        while (s->cap < new_cap) {
+            if (n + s->limit >= GSTACK_MAX_SEGMENTS - 1) {
+                return false;
+            }
+
+            const size_t len = (size_t) 1 << (s->limit + n);
+
+            if (len > SIZE_MAX / s->memb_size || !(segs[n] = GSTACK_MALLOC(len * s->memb_size))) {
+                return false;
+            }
+
+            s->cap += len;
+            ++n;
+        }
+        return true;
+    }
+
+    /* Shrinking frees whole segments, the first one excepted, for as long as
+     * the capacity exceeds the request and the elements still fit.
+     */
+    while (n > 1 && s->cap > new_cap) {
+        const size_t len = (size_t) 1 << (s->limit + n - 1);
+
+        if (s->cap - len < s->size) {
+            break;
+        }
+
+        GSTACK_FREE(segs[--n]);
+        s->cap -= len;
+    }
+
+    return true;
+}
+
+static bool gstack_segmented_init(gstack *s, size_t cap, const void *opts)
+{
+    (void) opts;
+
+    /* The first segment gets the requested capacity, rounded up to a power of
+     * two.
+     */
+    s->limit = gstack_log2(cap);
+
+    if (((size_t) 1 << s->limit) < cap) {
+        ++s->limit;
+    }
+
+    if (s->limit >= GSTACK_MAX_SEGMENTS - 1 || !(s->data = GSTACK_MALLOC(GSTACK_MAX_SEGMENTS * sizeof (char *)))) {
+        return false;
+    }
+
+    s->cap = 0;
+
+    if (!gstack_segmented_resize(s, 1)) {
+        GSTACK_FREE(s->data);
+        return false;
+    }
+
+    return true;
+}
+
+static size_t gstack_segmented_footprint(const gstack *s)
+{
+    return s->cap * s->memb_size + GSTACK_MAX_SEGMENTS * sizeof (char *);
+}
+
+static void gstack_segmented_fini(gstack *s)
+{
+    for (size_t n = gstack_segment_count(s); n-- > 0;) {
+        GSTACK_FREE(((char **) s->data)[n]);
+    }
+    GSTACK_FREE(s->data);
+}
+
+#ifdef GSTACK_HAS_MMAP
+/* Returns the count of bytes needed for `n` elements of the stack referenced by
+ * `s`, rounded up to a multiple of the page size, or 0 on overflow.
+ */
+static size_t gstack_page_bytes(const gstack *s, size_t n)
+{
+    const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+    if (n > (SIZE_MAX - page_size) / s->memb_size) {
+        return 0;
+    }
+
+    return (n * s->memb_size + page_size - 1) / page_size * page_size;
+}
+
+/* GSTACK_RESERVED. `limit` bytes of address space are reserved at `data`, and
+ * the pages holding the first `cap` elements are committed.
+ */
+static bool gstack_reserved_resize(gstack *s, size_t new_cap)
+{
+    const size_t bytes = gstack_page_bytes(s, new_cap);
+
+    if (bytes == 0 || bytes > s->limit) {
+        return false;
+    }
+
+    if (bytes == gstack_page_bytes(s, s->cap)) {
+        /* Nothing to commit or release. */
+        return new_cap <= s->cap;
+    }
+
+    if (new_cap > s->cap) {
+        if (mprotect(s->data, bytes, PROT_READ | PROT_WRITE) != 0) {
+            return false;
+        }
+    } else if (bytes < s->limit) {
+        /* Hand the pages back, but keep the address space. */
+        madvise((char *) s->data + bytes, s->limit - bytes, MADV_DONTNEED);
+        mprotect((char *) s->data + bytes, s->limit - bytes, PROT_NONE);
+    }
+
+    s->cap = bytes / s->memb_size;
+    return true;
+}
+
+static bool gstack_reserved_init(gstack *s, size_t cap, const void *opts)
+{
+    const size_t max = opts ? *(const size_t *) opts : GSTACK_RESERVE_DEFAULT / s->memb_size;
+
+    s->limit = gstack_page_bytes(s, max > cap ? max : cap);
+
+    if (s->limit == 0) {
+        return false;
+    }
+
+    s->data = mmap(NULL, s->limit, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (s->data == MAP_FAILED) {
+        return false;
+    }
+
+    s->cap = 0;
+
+    if (!gstack_reserved_resize(s, cap)) {
+        munmap(s->data, s->limit);
+        return false;
+    }
+
+    return true;
+}
+
+static void gstack_reserved_fini(gstack *s)
+{
+    munmap(s->data, s->limit);
+}
+
+/* GSTACK_FILE. The first `limit` bytes of the file `fd` are mapped at `data`. */
+static bool gstack_file_resize(gstack *s, size_t new_cap)
+{
+    const size_t bytes = gstack_page_bytes(s, new_cap);
+
+    if (bytes == s->limit) {
+        return bytes != 0;
+    }
+
+    if (bytes == 0 || (bytes > s->limit && ftruncate(s->fd, (off_t) bytes) != 0)) {
+        return false;
+    }
+
+    void *p;
+
+    if (s->limit == 0) {
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    } else {
+#ifdef MREMAP_MAYMOVE
+        p = mremap(s->data, s->limit, bytes, MREMAP_MAYMOVE);
+#else
+        /* The contents live in the file, so remapping it loses nothing. */
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+
+        if (p != MAP_FAILED) {
+            munmap(s->data, s->limit);
+        }
+#endif
+    }
+
+    if (p == MAP_FAILED) {
+        return false;
+    }
+
+    if (bytes < s->limit) {
+        /* Failing to give the blocks back to the file system is harmless. */
+        (void) !ftruncate(s->fd, (off_t) bytes);
+    }
+
+    s->data = p;
+    s->limit = bytes;
+    s->cap = bytes / s->memb_size;
+    return true;
+}
+
+static bool gstack_file_init(gstack *s, size_t cap, const void *opts)
+{
+    const char *const path = opts;
+
+    if (path) {
+        s->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    } else {
+        const char *const dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+        const size_t len = strlen(dir) + sizeof "/gstack-XXXXXX";
+        char *const tmp = GSTACK_MALLOC(len);
+
+        if (!tmp) {
+            return false;
+        }
+
+        snprintf(tmp, len, "%s/gstack-XXXXXX", dir);
+        s->fd = mkstemp(tmp);
+
+        if (s->fd != -1) {
+            unlink(tmp);
+        }
+        GSTACK_FREE(tmp);
+    }
+
+    if (s->fd == -1) {
+        return false;
+    }
+
+    s->limit = 0;
+
+    if (!gstack_file_resize(s, cap)) {
+        close(s->fd);
+        return false;
+    }
+
+    return true;
+}
+
+static size_t gstack_file_footprint(const gstack *s)
+{
+    return s->limit;
+}
+
+static void gstack_file_fini(gstack *s)
+{
+    munmap(s->data, s->limit);
+    close(s->fd);
+}
+#else
+static bool gstack_unavailable_init(gstack *s, size_t cap, const void *opts)
+{
+    (void) s;
+    (void) cap;
+    (void) opts;
+    return false;
+}
+
+#define gstack_reserved_init    gstack_unavailable_init
+#define gstack_reserved_resize  NULL
+#define gstack_reserved_fini    NULL
+#define gstack_file_init        gstack_unavailable_init
+#define gstack_file_resize      NULL
+#define gstack_file_fini        NULL
+#define gstack_file_footprint   NULL
+#endif                          /* GSTACK_HAS_MMAP */
+
+/* GSTACK_BOUNDED. */
+static bool gstack_bounded_init(gstack *s, size_t cap, const void *opts)
+{
+    (void) opts;
+    s->data = GSTACK_MALLOC(cap * s->memb_size);
+    s->cap = cap;
+    return s->data != NULL;
+}
+
+static bool gstack_bounded_resize(gstack *s, size_t new_cap)
+{
+    (void) s;
+    (void) new_cap;
+    return false;
+}
+
+static void gstack_bounded_fini(gstack *s)
+{
+    GSTACK_FREE(s->data);
+}
+
+/* GSTACK_INDIRECT. `data` points to a struct gstack_indirect, and `limit` holds
+ * the size of a block: the element size rounded up to the alignment of any
+ * object and to the size of a pointer, which threads the free list.
+ */
+struct gstack_indirect {
+    char **blocks;          /* The block bound to every position below `cap`. */
+    char *slabs;            /* The newest slab, which points to the previous one. */
+    char *free;             /* The newest unbound block, which points to the next. */
+    char *carve;            /* The first block of the newest slab not carved out yet. */
+    size_t carve_left;
+    size_t slab_bytes;      /* Of all the slabs, which are only freed with the stack. */
+};
+
+static void *gstack_indirect_slot(const gstack *s, size_t i)
+{
+    return ((const struct gstack_indirect *) s->data)->blocks[i];
+}
+
+/* Returns an unbound block, carving a slab of `want` blocks out if need be. */
+static char *gstack_indirect_take(gstack *s, size_t want)
+{
+    struct gstack_indirect *const ind = s->data;
+    const size_t header = sizeof (union gstack_max_align);
+
+    if (ind->free) {
+        char *const block = ind->free;
+
+        memcpy(&ind->free, block, sizeof (char *));
+        return block;
+    }
+
+    if (ind->carve_left == 0) {
+        if (want > (SIZE_MAX - header) / s->limit) {
+            return NULL;
+        }
+
+        char *const slab = GSTACK_MALLOC(header + want * s->limit);
+
+        if (!slab) {
+            return NULL;
+        }
+
+        memcpy(slab, &ind->slabs, sizeof (char *));
+        ind->slabs = slab;
+        ind->slab_bytes += header + want * s->limit;
+        ind->carve = slab + header;
+        ind->carve_left = want;
+    }
+
+    char *const block = ind->carve;
+
+    ind->carve += s->limit;
+    --ind->carve_left;
+    return block;
+}
+
+static bool gstack_indirect_resize(gstack *s, size_t new_cap)
+{
+    struct gstack_indirect *const ind = s->data;
+    const uintptr_t old = (uintptr_t) ind->blocks;
+
+    if (new_cap < s->cap) {
+        /* Unbind from the top down, so that the block of the lowest position
+         * is the first one bound again.
+         */
+        for (size_t i = s->cap; i-- > new_cap;) {
+            memcpy(ind->blocks[i], &ind->free, sizeof (char *));
+            ind->free = ind->blocks[i];
+        }
+
+        s->cap = new_cap;
+
+        /* On failure, the larger array is kept. */
+        char **const tmp = GSTACK_REALLOC(ind->blocks, new_cap * sizeof (char *));
+
+        if (tmp) {
+            if ((uintptr_t) tmp != old) {
+                GSTACK_COPIED(s, new_cap * sizeof (char *));
+            }
+            ind->blocks = tmp;
+        }
+        return true;
+    }
+
+    if (new_cap > SIZE_MAX / sizeof (char *)) {
+        return false;
+    }
+
+    char **const tmp = GSTACK_REALLOC(ind->blocks, new_cap * sizeof (char *));
+
+    if (!tmp) {
+        return false;
+    }
+
+    /* Only the table is copied; the elements stay in their blocks. */
+    if (old && (uintptr_t) tmp != old) {
+        GSTACK_COPIED(s, s->cap * sizeof (char *));
+    }
+
+    ind->blocks = tmp;
+
+    /* On failure, the positions bound so far are kept. */
+    for (; s->cap < new_cap; ++s->cap) {
+        if (!(ind->blocks[s->cap] = gstack_indirect_take(s, new_cap - s->cap))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* The unbound blocks are kept for reuse, so a shrink only gives back the bytes
+ * of the table of blocks.
+ */
+static size_t gstack_indirect_footprint(const gstack *s)
+{
+    const struct gstack_indirect *const ind = s->data;
+
+    return sizeof *ind + ind->slab_bytes + s->cap * sizeof (char *);
+}
+
+static void gstack_indirect_fini(gstack *s)
+{
+    struct gstack_indirect *const ind = s->data;
+
+    for (char *slab = ind->slabs, *prev; slab; slab = prev) {
+        memcpy(&prev, slab, sizeof (char *));
+        GSTACK_FREE(slab);
+    }
+
+    GSTACK_FREE(ind->blocks);
+    GSTACK_FREE(ind);
+}
+
+static bool gstack_indirect_init(gstack *s, size_t cap, const void *opts)
+{
+    const size_t align = sizeof (union gstack_max_align);
+
+    (void) opts;
+
+    if (s->memb_size > SIZE_MAX - align) {
+        return false;
+    }
+
+    s->limit = (s->memb_size + align - 1) / align * align;
+    s->cap = 0;
+
+    struct gstack_indirect *const ind = GSTACK_MALLOC(sizeof *ind);
+
+    if (!ind) {
+        return false;
+    }
+
+    ind->blocks = NULL;
+    ind->slabs = ind->free = ind->carve = NULL;
+    ind->carve_left = ind->slab_bytes = 0;
+    s->data = ind;
+
+    if (!gstack_indirect_resize(s, cap)) {
+        gstack_indirect_fini(s);
+        return false;
+    }
+
+    return true;
+}
+
+static const struct gstack_backend_ops gstack_backend_table[GSTACK_BACKEND_COUNT] = {
+    [GSTACK_CONTIGUOUS] = {
+        "contiguous", gstack_contiguous_init, gstack_contiguous_resize, NULL, gstack_contiguous_fini,
+        gstack_contiguous_footprint
+    },
+    [GSTACK_SEGMENTED] = {
+        "segmented", gstack_segmented_init, gstack_segmented_resize, gstack_segmented_slot,
+        gstack_segmented_fini, gstack_segmented_footprint
+    },
+    [GSTACK_RESERVED] = {
+        "reserved", gstack_reserved_init, gstack_reserved_resize, NULL, gstack_reserved_fini,
+        gstack_plain_footprint
+    },
+    [GSTACK_FILE] = {
+        "file", gstack_file_init, gstack_file_resize, NULL, gstack_file_fini, gstack_file_footprint
+    },
+    [GSTACK_BOUNDED] = {
+        "bounded", gstack_bounded_init, gstack_bounded_resize, NULL, gstack_bounded_fini,
+        gstack_plain_footprint
+    },
+    [GSTACK_INDIRECT] = {
+        "indirect", gstack_indirect_init, gstack_indirect_resize, gstack_indirect_slot,
+        gstack_indirect_fini, gstack_indirect_footprint
+    }
+};
+#endif                          /* GSTACK_BACKENDS */
+
+/* Returns the count of bytes of memory held by the storage of the stack
+ * referenced by `s`, which may differ from its capacity times the element size.
+ */
+static size_t gstack_footprint(const gstack *s)
+{
+#ifdef GSTACK_BACKENDS
+    return s->ops->footprint(s);
+#else
+    return gstack_contiguous_footprint(s);
+#endif
+}
+
+/* Every change of capacity goes through here, so that it stays out of the way
+ * of the pushes and pops that do not need one.
+ */
+#ifdef GSTACK_BUDGETS
+struct gstack_budget {
+    atomic_size_t used;
+    atomic_size_t limit;
+    atomic_size_t peak;
+    atomic_size_t failures;
+    atomic_size_t stacks;
+    bool (*on_exceed)(gstack_budget *b, gstack *s, size_t need, void *ctx);
+    void *ctx;
+};
+
+static void gstack_budget_raise_peak(gstack_budget *b, size_t used)
+{
+    size_t peak = atomic_load_explicit(&b->peak, memory_order_relaxed);
+
+    while (peak < used && !atomic_compare_exchange_weak_explicit(&b->peak, &peak, used,
+                                                                 memory_order_relaxed,
+                                                                 memory_order_relaxed)) {
+        ;
+    }
+}
+
+static void gstack_budget_add(gstack_budget *b, size_t bytes)
+{
+    gstack_budget_raise_peak(b, atomic_fetch_add_explicit(&b->used, bytes,
+                                                          memory_order_relaxed) + bytes);
+}
+
+/* Charges `bytes` to the budget of `s`, within its limit. */
+static bool gstack_budget_charge(gstack *s, size_t bytes)
+{
+    gstack_budget *const b = s->budget;
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        size_t used = atomic_load_explicit(&b->used, memory_order_relaxed);
+        size_t limit = atomic_load_explicit(&b->limit, memory_order_relaxed);
+
+        while (bytes <= limit && used <= limit - bytes) {
+            if (atomic_compare_exchange_weak_explicit(&b->used, &used, used + bytes,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                gstack_budget_raise_peak(b, used + bytes);
+                return true;
+            }
+
+            limit = atomic_load_explicit(&b->limit, memory_order_relaxed);
+        }
+
+        if (attempt > 0 || !b->on_exceed || !b->on_exceed(b, s, bytes, b->ctx)) {
+            break;
+        }
+    }
+
+    atomic_fetch_add_explicit(&b->failures, 1, memory_order_relaxed);
+    return false;
+}
+#endif                          /* GSTACK_BUDGETS */
+
+ATTRIB_COLD static bool gstack_resize(gstack *s, size_t new_cap)
+{
+    const size_t old_cap = s->cap;
+
+#ifdef GSTACK_BUDGETS
+    /* A growth is checked against what its new positions take at the least. */
+    const size_t held = s->budget ? gstack_footprint(s) : 0;
+    size_t charged = 0;
+
+    if (s->budget && new_cap > old_cap) {
+        size_t each = s->memb_size;
+
+#ifdef GSTACK_BACKENDS
+        if (s->backend == GSTACK_INDIRECT) {
+            each = s->limit + sizeof (char *);
+        }
+#endif
+        charged = new_cap - old_cap > SIZE_MAX / each ? SIZE_MAX : (new_cap - old_cap) * each;
+
+        if (!gstack_budget_charge(s, charged)) {
+            return false;
+        }
+    }
+#endif
+
+#ifdef GSTACK_HISTOGRAMS
+    const uint64_t start = gstack_now_ns();
+
+    s->copied = 0;
+#endif
+
+#ifdef GSTACK_BACKENDS
+    const bool ok = s->ops->resize(s, new_cap);
+#else
+    const bool ok = gstack_contiguous_resize(s, new_cap);
+#endif
+
+#ifdef GSTACK_BUDGETS
+    /* Settle what was charged with the memory actually allocated or freed. */
+    if (s->budget) {
+        const size_t now = gstack_footprint(s), before = held + charged;
+
+        if (now > before) {
+            gstack_budget_add(s->budget, now - before);
+        } else if (now < before) {
+            atomic_fetch_sub_explicit(&s->budget->used, before - now, memory_order_relaxed);
+        }
+    }
+#endif
+
+#ifdef GSTACK_SAMPLING
+    if (ok && s->samples && s->cap != old_cap) {
+        gstack_sample_record(s, s->cap > old_cap ? GSTACK_SAMPLE_GROW : GSTACK_SAMPLE_SHRINK);
+    }
+#endif
+
+    if (ok && s->cap > old_cap) {
+        GSTACK_PROBE(grow, s, old_cap, s->cap);
+#ifdef GSTACK_REGISTRY
+        atomic_fetch_add_explicit(&gstack_registry_grows, 1, memory_order_relaxed);
+#endif
+    } else if (ok && s->cap < old_cap) {
+        GSTACK_PROBE(shrink, s, old_cap, s->cap);
+#ifdef GSTACK_REGISTRY
+        atomic_fetch_add_explicit(&gstack_registry_shrinks, 1, memory_order_relaxed);
+#endif
+    }
+
+#ifdef GSTACK_HISTOGRAMS
+    if (ok && s->cap != old_cap) {
+        const uint64_t ns = gstack_now_ns() - start;
+        const uint64_t moved = s->copied;
+
+        if (s->hists) {
+            gstack_hists_record(s->hists, s->cap > old_cap, ns, moved);
+        }
+
+        gstack_hists_acquire();
+        gstack_hists_record(&gstack_hists_global, s->cap > old_cap, ns, moved);
+        gstack_hists_release();
+    }
+#endif
+    return ok;
+}
+
+/* Returns the address of the element at position `i` of the stack referenced by
+ * `s`, which must be less than its capacity.
+ */
+static void *gstack_slot(const gstack *s, size_t i)
+{
+#ifdef GSTACK_BACKENDS
+    if (!s->contiguous) {
+        return s->ops->slot(s, i);
+    }
+#endif
+    return (char *) s->data + i * s->memb_size;
+}
+
+#ifdef GSTACK_TOMBSTONES
+static bool gstack_is_dead(const gstack *s, size_t i)
+{
+    return s->dead_count && i / 64 < s->dead_words && (s->dead[i / 64] >> i % 64 & 1);
+}
+
+/* Returns the first position from `i` on that is a tombstone if `dead`, or
+ * that is not if not, or `size` if there is none.
+ */
+static size_t gstack_dead_find(const gstack *s, size_t i, bool dead)
+{
+    while (i < s->size) {
+        uint64_t w = i / 64 < s->dead_words ? s->dead[i / 64] : 0;
+
+        w = (dead ? w : ~w) >> i % 64;
+
+        if (w) {
+#if defined(__GNUC__) || defined(__clang__)
+            i += (unsigned) __builtin_ctzll(w);
+#else
+            for (; !(w & 1); w >>= 1) {
+                ++i;
+            }
+#endif
+            break;
+        }
+
+        i = (i / 64 + 1) * 64;
+    }
+
+    return i < s->size ? i : s->size;
+}
+
+/* Pops the tombstones off the top. */
+static void gstack_settle(gstack *s)
+{
+    while (s->size && gstack_is_dead(s, s->size - 1)) {
+        --s->size;
+        s->dead[s->size / 64] &= ~((uint64_t) 1 << s->size % 64);
+        --s->dead_count;
+    }
+}
+#endif                          /* GSTACK_TOMBSTONES */
+
+GSTACK_DEF bool gstack_is_full(const gstack *s)
+{
+    return s->size == s->cap;
+}
+
+GSTACK_DEF bool (gstack_is_empty)(const gstack *s)
+{
+    return s->size == 0;
+}
+
+GSTACK_DEF const void *(gstack_peek)(const gstack *s)
+{
+    if (gstack_is_empty(s)) {
+        return NULL;
+    }
+
+    return gstack_slot(s, s->size - 1);
+}
+
+/* Creates a stack, which is left out of the registry. */
+#ifdef GSTACK_BACKENDS
+static gstack *gstack_make(size_t cap, size_t memb_size, gstack_backend backend, const void *opts)
+#else
+static gstack *gstack_make(size_t cap, size_t memb_size)
+#endif
+{
+#ifdef GSTACK_BACKENDS
+    if ((unsigned) backend >= GSTACK_BACKEND_COUNT) {
+        return NULL;
+    }
+#else
+    const void *const opts = NULL;
+#endif
+
+    if (cap == 0 || memb_size == 0 || cap > SIZE_MAX / memb_size) {
+        return NULL;
+    }
+
+    gstack *const s = GSTACK_MALLOC(sizeof *s);
+
+    if (s) {
+        s->size = 0;
+        s->memb_size = memb_size;
+
+#ifdef GSTACK_BACKENDS
+        s->backend = backend;
+        s->ops = &gstack_backend_table[backend];
+        s->contiguous = s->ops->slot == NULL;
+
+        const bool ok = s->ops->init(s, cap, opts);
+#else
+        const bool ok = gstack_contiguous_init(s, cap, opts);
+#endif
+
+        if (ok) {
+            s->undo = NULL;
+            s->undo_cap = 0;
+            s->in_txn = false;
+#ifdef GSTACK_SAMPLING
+            s->samples = NULL;
+#endif
+#ifdef GSTACK_HISTOGRAMS
+            s->hists = NULL;
+#endif
+#ifdef GSTACK_BUDGETS
+            s->budget = NULL;
+#endif
+#ifdef GSTACK_TOMBSTONES
+            s->dead = NULL;
+            s->dead_words = 0;
+            s->dead_count = 0;
+#endif
+            GSTACK_PROBE(create, s, s->cap, s->cap);
+#ifdef GSTACK_REGISTRY
+            s->touched = true;
+            s->label = NULL;
+            s->registered = false;
+#endif
+        } else {
+            GSTACK_FREE(s);
+            return NULL;
+        }
+    }
+
+    return s;
+}
+
+/* Adds the stack referenced by `s`, unless NULL, to the registry. Returns `s`. */
+static gstack *gstack_register(gstack *s)
+{
+#ifdef GSTACK_REGISTRY
+    if (s) {
+        s->registered = true;
+        gstack_registry_add(s);
+    }
+#endif
+    return s;
+}
+
+/* Creates a stack owned by another structure of this library, which it
+ * synchronizes or hands out pointers into. It is kept out of the registry, so
+ * that gstack_trim_all() never resizes it behind its owner's back.
+ */
+static gstack *gstack_create_internal(size_t cap, size_t memb_size)
+{
+#ifdef GSTACK_BACKENDS
+    return gstack_make(cap, memb_size, GSTACK_CONTIGUOUS, NULL);
+#else
+    return gstack_make(cap, memb_size);
+#endif
+}
+
+#ifdef GSTACK_BACKENDS
+GSTACK_DEF gstack *gstack_create(size_t cap, size_t memb_size)
+{
+    return gstack_create_with(cap, memb_size, GSTACK_CONTIGUOUS, NULL);
+}
+
+GSTACK_DEF gstack *gstack_create_with(size_t cap, size_t memb_size, gstack_backend backend,
+                                      const void *opts)
+{
+    return gstack_register(gstack_make(cap, memb_size, backend, opts));
+}
+#else
+GSTACK_DEF gstack *gstack_create(size_t cap, size_t memb_size)
+{
+    return gstack_register(gstack_make(cap, memb_size));
+}
+#endif                          /* GSTACK_BACKENDS */
+
+/* Saves the element at position `p` of the stack referenced by `s`, which must
+ * lie below txn_base, before a push overwrites it.
+ *
+ * As a push always lands on the count of elements, the saved positions form a
+ * single range: a push lands either inside it, right above it, or below it
+ * after popping past it, in which case the positions in between have not been
+ * overwritten yet and are saved along.
+ */
+static bool gstack_txn_save(gstack *s, size_t p)
+{
+    if (p >= s->txn_lo && p < s->txn_hi) {
+        return true;
+    }
+
+    const bool none = s->txn_lo == s->txn_hi;
+    const size_t lo = none || p < s->txn_lo ? p : s->txn_lo;
+    const size_t hi = none || p >= s->txn_hi ? p + 1 : s->txn_hi;
+
+    if (s->txn_base - lo > s->undo_cap) {
+        size_t new_cap = s->undo_cap ? s->undo_cap : 16;
+
+        while (new_cap < s->txn_base - lo) {
+            new_cap *= 2;
+        }
+
+        void *const tmp = GSTACK_REALLOC(s->undo, new_cap * s->memb_size);
+
+        if (!tmp) {
+            return false;
+        }
+
+        s->undo = tmp;
+        s->undo_cap = new_cap;
+    }
+
+    for (size_t i = lo; i < hi; ++i) {
+        if (i >= s->txn_lo && i < s->txn_hi) {
+            continue;
+        }
+        memcpy((char *) s->undo + (s->txn_base - 1 - i) * s->memb_size,
+               gstack_slot(s, i), s->memb_size);
+    }
+
+    s->txn_lo = lo;
+    s->txn_hi = hi;
+    return true;
+}
+
+/* Makes room for one more element on top of the stack referenced by `s`, and
+ * returns its address, or NULL on failure. Everything gstack_push() does, but
+ * copying the element.
+ */
+static void *gstack_push_slot(gstack *s)
+{
+    if (s->in_txn && s->size < s->txn_base && !gstack_txn_save(s, s->size)) {
+        return NULL;
+    }
+
+    if (s->size >= s->cap) {
+        const bool cond = s->cap > SIZE_MAX / 2;
+
+        if (cond || !gstack_resize(s, s->cap * 2)) {
+            return NULL;
+        }
+    } 
+
+#ifdef GSTACK_REGISTRY
+    s->touched = true;
+#endif
+
+#ifdef GSTACK_SAMPLING
+    void *const slot = gstack_slot(s, s->size++);
+    gstack_sample_tick(s);
+    return slot;
+#else
+    return gstack_slot(s, s->size++);
+#endif
+}
+
+GSTACK_DEF bool (gstack_push)(gstack *s, const void *data)
+{
+    void *const target = gstack_push_slot(s);
+
+    if (!target) {
+        return false;
+    }
+
+    memcpy(target, data, s->memb_size);
+    return true;
+}
+
+GSTACK_DEF void *(gstack_pop)(gstack *s)
+{
+    if (gstack_is_empty(s)) {
+        return NULL;
+    }
+
+    const size_t top = --s->size;
+
+#ifdef GSTACK_TOMBSTONES
+    gstack_settle(s);
+#endif
+
+#ifdef GSTACK_REGISTRY
+    s->touched = true;
+#endif
+        
+    /* Half the array size if it is too large, or when it is less than one-fourth
+     * the array size. This is the approach CLRS suggests. The element popped
+     * must stay within, even if tombstones were popped along.
+     */
+    if (!s->in_txn && top && (top <= s->cap / 4)) {
+        /* On failure, do nothing. The original memory is left intact. */
+        (void) gstack_resize(s, s->cap / 2);
+    }
+
+#ifdef GSTACK_SAMPLING
+    gstack_sample_tick(s);
+#endif
+    
+    return gstack_slot(s, top);
+}
+
+#define GSTACK_DEFINE_TYPED(name, type)                                 \
+    GSTACK_DEF bool (gstack_push_##name)(gstack *s, type value)         \
+    {                                                                   \
+        if (s->memb_size != sizeof value) {                             \
+            return false;                                               \
+        }                                                               \
+                                                                        \
+        void *const target = gstack_push_slot(s);                       \
+                                                                        \
+        if (!target) {                                                  \
+            return false;                                               \
+        }                                                               \
+                                                                        \
+        memcpy(target, &value, sizeof value);                           \
+        return true;                                                    \
+    }                                                                   \
+                                                                        \
+    GSTACK_DEF type (gstack_pop_##name)(gstack *s)                      \
+    {                                                                   \
+        type value = 0;                                                 \
+                                                                        \
+        if (s->memb_size != sizeof value) {                             \
+            return value;                                               \
+        }                                                               \
+                                                                        \
+        const void *const p = gstack_pop(s);                            \
+                                                                        \
+        if (p) {                                                        \
+            memcpy(&value, p, sizeof value);                            \
+        }                                                               \
+        return value;                                                   \
+    }                                                                   \
+                                                                        \
+    GSTACK_DEF type (gstack_peek_##name)(const gstack *s)               \
+    {                                                                   \
+        type value = 0;                                                 \
+                                                                        \
+        if (s->memb_size != sizeof value) {                             \
+            return value;                                               \
+        }                                                               \
+                                                                        \
+        const void *const p = gstack_peek(s);                           \
+                                                                        \
+        if (p) {                                                        \
+            memcpy(&value, p, sizeof value);                            \
+        }                                                               \
+        return value;                                                   \
+    }
+
+GSTACK_TYPES(GSTACK_DEFINE_TYPED)
+
+GSTACK_DEF void gstack_destroy(gstack *s)
+{
+    GSTACK_PROBE(destroy, s, s->cap, s->cap);
+
+#ifdef GSTACK_REGISTRY
+    gstack_registry_remove(s);
+#endif
+    GSTACK_FREE(s->undo);
+
+#ifdef GSTACK_SAMPLING
+    GSTACK_FREE(s->samples);
+#endif
+
+#ifdef GSTACK_HISTOGRAMS
+    GSTACK_FREE(s->hists);
+#endif
+
+#ifdef GSTACK_TOMBSTONES
+    GSTACK_FREE(s->dead);
+#endif
+
+#ifdef GSTACK_BUDGETS
+    if (s->budget) {
+        atomic_fetch_sub_explicit(&s->budget->used, gstack_footprint(s), memory_order_relaxed);
+        atomic_fetch_sub_explicit(&s->budget->stacks, 1, memory_order_relaxed);
+    }
+#endif
+
+#ifdef GSTACK_BACKENDS
+    s->ops->fini(s);
+#else
+    gstack_contiguous_fini(s);
+#endif
+
+    GSTACK_FREE(s);
+}
+
+GSTACK_DEF size_t (gstack_size)(const gstack *s)
+{
+    return s->size;
+}
+
+GSTACK_DEF size_t gstack_capacity(const gstack *s)
+{
+    return s->cap;
+}
+
+GSTACK_DEF bool gstack_reserve(gstack *s, size_t n)
+{
+    if (n > SIZE_MAX - s->size) {
+        return false;
+    }
+
+    const size_t need = s->size + n;
+
+    if (need <= s->cap) {
+        return true;
+    }
+
+    /* Grow geometrically all the same, lest reserving one element at a time
+     * turns quadratic.
+     */
+    return gstack_resize(s, s->cap <= SIZE_MAX / 2 && s->cap * 2 > need ? s->cap * 2 : need);
+}
+
+GSTACK_DEF void *gstack_at(const gstack *s, size_t i)
+{
+#ifdef GSTACK_TOMBSTONES
+    if (gstack_is_dead(s, i)) {
+        return NULL;
+    }
+#endif
+    return i < s->size ? gstack_slot(s, i) : NULL;
+}
+
+GSTACK_DEF bool gstack_iterate(const gstack *s, bool (*fn)(const void *elem, void *ctx), void *ctx)
+{
+    for (size_t i = 0; i < s->size; ++i) {
+#ifdef GSTACK_TOMBSTONES
+        if (gstack_is_dead(s, i)) {
+            continue;
+        }
+#endif
+        if (!fn(gstack_slot(s, i), ctx)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/* The bytes gstack_push_from_fd() reads at once, at least, when it has to grow
+ * the stack or to read into a buffer.
+ */
+#define GSTACK_READ_CHUNK       ((size_t) 64 << 10)
+
+/* gstack_push_from_fd() for the stacks whose pushes cannot skip the
+ * bookkeeping: read into a buffer, then push every element.
+ */
+static size_t gstack_push_from_fd_buffered(gstack *s, int fd, size_t max_elems)
+{
+    const size_t per_read = GSTACK_READ_CHUNK / s->memb_size + 1;
+    char *const buf = GSTACK_MALLOC(per_read * s->memb_size);
+    const int saved_errno = errno;
+    size_t pushed = 0, partial = 0;
+
+    if (!buf) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    while (pushed < max_elems) {
+        const size_t room = max_elems - pushed < per_read ? max_elems - pushed : per_read;
+        const ssize_t n = read(fd, buf + partial, room * s->memb_size - partial);
+
+        if (n < 0 && errno == EINTR) {
+            errno = saved_errno;
+            continue;
+        } else if (n <= 0) {
+            break;
+        }
+
+        partial += (size_t) n;
+
+        const size_t full = partial / s->memb_size;
+
+        for (size_t i = 0; i < full; ++i, ++pushed) {
+            if (!gstack_push(s, buf + i * s->memb_size)) {
+                GSTACK_FREE(buf);
+                errno = ENOMEM;
+                return pushed;
+            }
+        }
+
+        partial -= full * s->memb_size;
+        memmove(buf, buf + full * s->memb_size, partial);
+    }
+
+    GSTACK_FREE(buf);
+    return pushed;
+}
+
+GSTACK_DEF size_t gstack_push_from_fd(gstack *s, int fd, size_t max_elems)
+{
+    const size_t m = s->memb_size;
+    const int saved_errno = errno;
+    size_t pushed = 0, partial = 0;
+
+    if (s->in_txn
+#ifdef GSTACK_BACKENDS
+        || !s->contiguous
+#endif
+#ifdef GSTACK_SAMPLING
+        || s->samples
+#endif
+        ) {
+        return gstack_push_from_fd_buffered(s, fd, max_elems);
+    }
+
+    /* The bytes of an element read in part wait in the slot above the top,
+     * which lies within the capacity, so the stack only grows between two
+     * elements.
+     */
+    while (pushed < max_elems) {
+        if (s->size == s->cap) {
+            const size_t left = max_elems - pushed;
+            const size_t chunk = GSTACK_READ_CHUNK / m + 1;
+
+            if (!gstack_reserve(s, left < chunk ? left : chunk)) {
+                errno = ENOMEM;
+                break;
+            }
+        }
+
+        const size_t left = max_elems - pushed;
+        const size_t room = s->cap - s->size < left ? s->cap - s->size : left;
+        char *const tail = (char *) s->data + s->size * m;
+        const ssize_t n = read(fd, tail + partial, room * m - partial);
+
+        if (n < 0 && errno == EINTR) {
+            errno = saved_errno;
+            continue;
+        } else if (n <= 0) {
+            break;
+        }
+
+        partial += (size_t) n;
+
+        const size_t full = partial / m;
+
+        s->size += full;
+        pushed += full;
+        partial -= full * m;
+    }
+
+#ifdef GSTACK_REGISTRY
+    s->touched = true;
+#endif
+    return pushed;
+}
+
+/* Writes all the `n` buffers of `iov`, which it consumes. */
+static bool gstack_writev_all(int fd, struct iovec *iov, int n)
+{
+    while (n > 0) {
+        const ssize_t r = writev(fd, iov, n);
+
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        size_t done = (size_t) r;
+
+        for (; n > 0 && done >= iov->iov_len; ++iov, --n) {
+            done -= iov->iov_len;
+        }
+
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+
+    return true;
+}
+
+GSTACK_DEF bool gstack_write_to_fd(const gstack *s, int fd)
+{
+    struct iovec iov[GSTACK_IOV_BATCH];
+    int n = 0;
+
+    /* Every run of elements adjacent in memory makes a single buffer. */
+    for (size_t i = 0; i < s->size; ++i) {
+#ifdef GSTACK_TOMBSTONES
+        if (gstack_is_dead(s, i)) {
+            continue;
+        }
+#endif
+        char *const elem = gstack_slot(s, i);
+
+        if (n > 0 && (char *) iov[n - 1].iov_base + iov[n - 1].iov_len == elem) {
+            iov[n - 1].iov_len += s->memb_size;
+            continue;
+        }
+
+        if (n == GSTACK_IOV_BATCH) {
+            if (!gstack_writev_all(fd, iov, n)) {
+                return false;
+            }
+            n = 0;
+        }
+
+        iov[n].iov_base = elem;
+        iov[n].iov_len = s->memb_size;
+        ++n;
+    }
+
+    return gstack_writev_all(fd, iov, n);
+}
+#endif                          /* __unix__ || __APPLE__ */
+
+#ifdef GSTACK_BACKENDS
+GSTACK_DEF gstack_backend gstack_backend_of(const gstack *s)
+{
+    return s->backend;
+}
+
+GSTACK_DEF const char *gstack_backend_name(gstack_backend backend)
+{
+    return (unsigned) backend < GSTACK_BACKEND_COUNT ? gstack_backend_table[backend].name : NULL;
+}
+#endif                          /* GSTACK_BACKENDS */
+
+GSTACK_DEF size_t gstack_trim(gstack *s, double max_slack_ratio)
+{
+    if (s->in_txn) {
+        return 0;
+    }
+
+    const double limit = (double) s->size * (1.0 + (max_slack_ratio > 0 ? max_slack_ratio : 0));
+    const size_t new_cap = limit < (double) s->cap ? (size_t) limit : s->cap;
+    const size_t before = gstack_footprint(s);
+
+    if (new_cap >= s->cap || !gstack_resize(s, new_cap ? new_cap : 1)) {
+        return 0;
+    }
+
+    const size_t after = gstack_footprint(s);
+
+    return after < before ? before - after : 0;
+}
+
+#ifdef GSTACK_REGISTRY
+/* Copies the addresses of all the registered stacks to a new array, and stores
+ * their count to `n`, so that they can be operated on without holding the lock.
+ * Returns NULL on failure to allocate it.
+ */
+static gstack **gstack_registry_list(size_t *n)
+{
+    for (;;) {
+        gstack_registry_acquire();
+        const size_t count = gstack_registry_count;
+        gstack_registry_release();
+
+        /* Never 0 bytes, which malloc() may fail. */
+        gstack **const list = GSTACK_MALLOC((count + 1) * sizeof *list);
+
+        if (!list) {
+            return NULL;
+        }
+
+        gstack_registry_acquire();
+
+        if (gstack_registry_count <= count) {
+            *n = 0;
+
+            for (gstack *s = gstack_registry; s; s = s->next) {
+                list[(*n)++] = s;
+            }
+
+            gstack_registry_release();
+            return list;
+        }
+
+        /* Stacks were created meanwhile. */
+        gstack_registry_release();
+        GSTACK_FREE(list);
+    }
+}
+
+GSTACK_DEF size_t gstack_trim_all(double max_slack_ratio)
+{
+    size_t released = 0, n;
+    gstack **const list = gstack_registry_list(&n);
+
+    if (!list) {
+        return 0;
+    }
+
+    /* Without the lock, which reallocations would hold for long. */
+    for (size_t i = 0; i < n; ++i) {
+        if (list[i]->touched) {
+            list[i]->touched = false;
+        } else {
+            released += gstack_trim(list[i], max_slack_ratio);
+        }
+    }
+
+    GSTACK_FREE(list);
+    return released;
+}
+
+GSTACK_DEF size_t gstack_rss(void)
+{
+#ifdef __linux__
+    FILE *const fp = fopen("/proc/self/statm", "r");
+    unsigned long pages = 0;
+
+    if (!fp) {
+        return 0;
+    }
+
+    /* The second field is the count of resident pages. */
+    const int rc = fscanf(fp, "%*s %lu", &pages);
+    const long page_size = sysconf(_SC_PAGESIZE);
+
+    fclose(fp);
+    return rc == 1 && page_size > 0 ? (size_t) pages * (size_t) page_size : 0;
+#else
+    return 0;
+#endif                          /* __linux__ */
+}
+
+GSTACK_DEF size_t gstack_trim_if_rss_above(size_t threshold, double max_slack_ratio)
+{
+    return gstack_rss() > threshold ? gstack_trim_all(max_slack_ratio) : 0;
+}
+
+GSTACK_DEF void gstack_set_label(gstack *s, const char *label)
+{
+    gstack_registry_acquire();
+    s->label = label;
+    gstack_registry_release();
+}
+
+/* Text rendered into a buffer of `len` bytes, of which `pos` would be used if
+ * it were long enough.
+ */
+struct gstack_metrics_text {
+    char *buf;
+    size_t len;
+    size_t pos;
+};
+
+static void gstack_metrics_printf(struct gstack_metrics_text *t, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    const int n = vsnprintf(t->pos < t->len ? t->buf + t->pos : NULL,
+                            t->pos < t->len ? t->len - t->pos : 0, fmt, ap);
+    va_end(ap);
+
+    if (n > 0) {
+        t->pos += (size_t) n;
+    }
+}
+
+/* What the metrics are rendered from, one per stack. */
+struct gstack_metrics_row {
+    const char *label;
+    size_t used;
+    size_t slack;
+};
+
+/* Orders the unlabeled stacks first, then by label. */
+static int gstack_metrics_compare(const void *a, const void *b)
+{
+    const char *const x = ((const struct gstack_metrics_row *) a)->label;
+    const char *const y = ((const struct gstack_metrics_row *) b)->label;
+
+    if (!x || !y) {
+        return (x != NULL) - (y != NULL);
+    }
+
+    return strcmp(x, y);
+}
+
+/* Renders the series of one gauge, one per label, from `n` rows sorted by
+ * label.
+ */
+static void gstack_metrics_gauge(struct gstack_metrics_text *t, const char *name,
+                                 const char *help, const struct gstack_metrics_row *rows,
+                                 size_t n, size_t (*value)(const struct gstack_metrics_row *))
+{
+    gstack_metrics_printf(t, "# HELP %s %s\n# TYPE %s gauge\n", name, help, name);
+
+    for (size_t i = 0, j; i < n; i = j) {
+        const char *const label = rows[i].label;
+        size_t total = 0;
+
+        for (j = i; j < n && gstack_metrics_compare(&rows[i], &rows[j]) == 0; ++j) {
+            total += value(&rows[j]);
+        }
+
+        if (!label) {
+            gstack_metrics_printf(t, "%s %zu\n", name, total);
+            continue;
+        }
+
+        gstack_metrics_printf(t, "%s{label=\"", name);
+
+        for (const char *c = label; *c; ++c) {
+            if (*c == '\\' || *c == '"') {
+                gstack_metrics_printf(t, "\\%c", *c);
+            } else if (*c == '\n') {
+                gstack_metrics_printf(t, "\\n");
+            } else {
+                gstack_metrics_printf(t, "%c", *c);
+            }
+        }
+
+        gstack_metrics_printf(t, "\"} %zu\n", total);
+    }
+}
+
+static size_t gstack_metrics_count(const struct gstack_metrics_row *r)
+{
+    (void) r;
+    return 1;
+}
+
+static size_t gstack_metrics_used(const struct gstack_metrics_row *r)
+{
+    return r->used;
+}
+
+static size_t gstack_metrics_slack(const struct gstack_metrics_row *r)
+{
+    return r->slack;
+}
+
+/* Copies a row per live stack to a new array, and stores their count to `n`.
+ * Returns NULL on failure to allocate it.
+ */
+static struct gstack_metrics_row *gstack_metrics_rows(size_t *n)
+{
+    gstack **const list = gstack_registry_list(n);
+
+    if (!list) {
+        return NULL;
+    }
+
+    /* Never 0 bytes, which malloc() may fail. */
+    struct gstack_metrics_row *const rows = GSTACK_MALLOC((*n + 1) * sizeof *rows);
+
+    if (rows) {
+        for (size_t i = 0; i < *n; ++i) {
+            const gstack *const s = list[i];
+            const size_t used = s->size * s->memb_size, held = gstack_footprint(s);
+
+            rows[i] = (struct gstack_metrics_row) {
+                s->label, used, held > used ? held - used : 0
+            };
+        }
+    }
+
+    GSTACK_FREE(list);
+    return rows;
+}
+
+GSTACK_DEF size_t gstack_metrics_render(char *buf, size_t len)
+{
+    struct gstack_metrics_text t = { buf, len, 0 };
+    size_t n;
+
+    if (len > 0) {
+        buf[0] = '\0';
+    }
+
+    struct gstack_metrics_row *const rows = gstack_metrics_rows(&n);
+
+    if (!rows) {
+        return 0;
+    }
+
+    qsort(rows, n, sizeof *rows, gstack_metrics_compare);
+    gstack_metrics_gauge(&t, "gstack_stacks", "Live stacks.", rows, n, gstack_metrics_count);
+    gstack_metrics_gauge(&t, "gstack_bytes_used", "Bytes held by elements.", rows, n,
+                         gstack_metrics_used);
+    gstack_metrics_gauge(&t, "gstack_bytes_slack", "Bytes held but not used by elements.",
+                         rows, n, gstack_metrics_slack);
+    GSTACK_FREE(rows);
+
+    gstack_metrics_printf(&t, "# HELP gstack_grows_total Capacity increases.\n"
+                              "# TYPE gstack_grows_total counter\n"
+                              "gstack_grows_total %zu\n",
+                          atomic_load_explicit(&gstack_registry_grows, memory_order_relaxed));
+    gstack_metrics_printf(&t, "# HELP gstack_shrinks_total Capacity decreases.\n"
+                              "# TYPE gstack_shrinks_total counter\n"
+                              "gstack_shrinks_total %zu\n",
+                          atomic_load_explicit(&gstack_registry_shrinks, memory_order_relaxed));
+    return t.pos;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+GSTACK_DEF bool gstack_metrics_write(int fd)
+{
+    char small[4096];
+    char *buf = small;
+    size_t cap = sizeof small;
+    size_t len = gstack_metrics_render(buf, cap);
+
+    /* Stacks may come and go between two renderings, hence the loop. */
+    while (len >= cap) {
+        if (buf != small) {
+            GSTACK_FREE(buf);
+        }
+
+        cap = len + len / 2 + 1;
+
+        if (!(buf = GSTACK_MALLOC(cap))) {
+            return false;
+        }
+
+        len = gstack_metrics_render(buf, cap);
+    }
+
+    /* Nothing is rendered only on failure. */
+    bool ok = len != 0;
+
+    for (size_t done = 0; done < len;) {
+        const ssize_t n = write(fd, buf + done, len - done);
+
+        if (n < 0 && errno != EINTR) {
+            ok = false;
+            break;
+        }
+
+        done += n > 0 ? (size_t) n : 0;
+    }
+
+    if (buf != small) {
+        GSTACK_FREE(buf);
+    }
+
+    return ok;
+}
+#endif
+#endif                          /* GSTACK_REGISTRY */
+
+GSTACK_DEF size_t gstack_mark(const gstack *s)
+{
+    return s->size;
+}
+
+GSTACK_DEF bool gstack_rewind(gstack *s, size_t mark)
+{
+    if (mark > s->size) {
+        return false;
+    }
+
+#ifdef GSTACK_TOMBSTONES
+    for (size_t i = gstack_dead_find(s, mark, true); s->dead_count && i < s->size;
+         i = gstack_dead_find(s, i + 1, true)) {
+        s->dead[i / 64] &= ~((uint64_t) 1 << i % 64);
+        --s->dead_count;
+    }
+#endif
+
+    s->size = mark;
+
+#ifdef GSTACK_TOMBSTONES
+    gstack_settle(s);
+#endif
+    return true;
+}
+
+GSTACK_DEF bool gstack_txn_begin(gstack *s)
+{
+    if (s->in_txn) {
+        return false;
+    }
+
+#ifdef GSTACK_TOMBSTONES
+    /* So that the tombstones need no undoing. */
+    gstack_compact(s);
+#endif
+
+    s->in_txn = true;
+    s->txn_base = s->size;
+    s->txn_lo = s->txn_hi = 0;
+    return true;
+}
+
+GSTACK_DEF bool gstack_txn_commit(gstack *s)
+{
+    if (!s->in_txn) {
+        return false;
+    }
+
+    /* The undo area is kept around for the next transaction. */
+    s->in_txn = false;
+    return true;
+}
+
+GSTACK_DEF bool gstack_txn_abort(gstack *s)
+{
+    if (!s->in_txn) {
+        return false;
+    }
+
+    for (size_t i = s->txn_lo; i < s->txn_hi; ++i) {
+        memcpy(gstack_slot(s, i),
+               (char *) s->undo + (s->txn_base - 1 - i) * s->memb_size, s->memb_size);
+    }
+
+    s->size = s->txn_base;
+    s->in_txn = false;
+    return true;
+}
+
+#ifdef GSTACK_TOMBSTONES
+/* Makes `dead` cover every position below `size`. */
+static bool gstack_dead_reserve(gstack *s)
+{
+    const size_t words = s->size / 64 + 1;
+
+    if (words <= s->dead_words) {
+        return true;
+    }
+
+    const size_t new_words = words > 2 * s->dead_words ? words : 2 * s->dead_words;
+    uint64_t *const dead = GSTACK_REALLOC(s->dead, new_words * sizeof *dead);
+
+    if (!dead) {
+        return false;
+    }
+
+    memset(dead + s->dead_words, 0, (new_words - s->dead_words) * sizeof *dead);
+    s->dead = dead;
+    s->dead_words = new_words;
+    return true;
+}
+
+static void gstack_bury(gstack *s, size_t i)
+{
+    s->dead[i / 64] |= (uint64_t) 1 << i % 64;
+    ++s->dead_count;
+}
+
+/* Settles the top after a removal, and compacts if the tombstones are too many. */
+static void gstack_after_removal(gstack *s)
+{
+    gstack_settle(s);
+
+    if ((double) s->dead_count > (double) s->size * GSTACK_TOMBSTONE_RATIO) {
+        gstack_compact(s);
+    }
+}
+
+GSTACK_DEF bool gstack_remove_at(gstack *s, size_t i)
+{
+    if (s->in_txn || i >= s->size || gstack_is_dead(s, i) || !gstack_dead_reserve(s)) {
+        return false;
+    }
+
+    gstack_bury(s, i);
+    gstack_after_removal(s);
+    return true;
+}
+
+GSTACK_DEF size_t gstack_remove_if(gstack *s, bool (*pred)(const void *elem, void *ctx), void *ctx)
+{
+    size_t removed = 0;
+
+    if (s->in_txn || !gstack_dead_reserve(s)) {
+        return 0;
+    }
+
+    for (size_t i = gstack_dead_find(s, 0, false); i < s->size;
+         i = gstack_dead_find(s, i + 1, false)) {
+        if (pred(gstack_slot(s, i), ctx)) {
+            gstack_bury(s, i);
+            ++removed;
+        }
+    }
+
+    if (removed) {
+        gstack_after_removal(s);
+    }
+
+    return removed;
+}
+
+GSTACK_DEF size_t gstack_tombstones(const gstack *s)
+{
+    return s->dead_count;
+}
+
+GSTACK_DEF void gstack_compact(gstack *s)
+{
+    if (!s->dead_count) {
+        return;
+    }
+
+    size_t to = gstack_dead_find(s, 0, true);
+
+    /* Move down every run of elements between tombstones. */
+    for (size_t from = gstack_dead_find(s, to, false); from < s->size;) {
+        const size_t end = gstack_dead_find(s, from, true);
+        const size_t n = end - from;
+
+#ifdef GSTACK_BACKENDS
+        if (!s->contiguous) {
+            for (size_t k = 0; k < n; ++k) {
+                memcpy(gstack_slot(s, to + k), gstack_slot(s, from + k), s->memb_size);
+            }
+        } else
+#endif
+        {
+            memmove((char *) s->data + to * s->memb_size,
+                    (char *) s->data + from * s->memb_size, n * s->memb_size);
+        }
+
+        to += n;
+        from = gstack_dead_find(s, end, false);
+    }
+
+    const size_t words = s->size / 64 + 1;
+
+    memset(s->dead, 0, (words < s->dead_words ? words : s->dead_words) * sizeof *s->dead);
+    s->size = to;
+    s->dead_count = 0;
+}
+#endif                          /* GSTACK_TOMBSTONES */
+
+#ifdef GSTACK_SAMPLING
+GSTACK_DEF bool gstack_sample_start(gstack *s, size_t ring_len, size_t every)
+{
+    if (ring_len == 0 || ring_len > SIZE_MAX / sizeof *s->samples) {
+        return false;
+    }
+
+    gstack_sample *const samples = GSTACK_MALLOC(ring_len * sizeof *samples);
+
+    if (!samples) {
+        return false;
+    }
+
+    GSTACK_FREE(s->samples);
+    s->samples = samples;
+    s->sample_cap = ring_len;
+    s->sample_count = 0;
+    s->sample_every = every;
+    s->sample_tick = every;
+    s->sample_origin = gstack_now_ns();
+    return true;
+}
+
+GSTACK_DEF void gstack_sample_stop(gstack *s)
+{
+    GSTACK_FREE(s->samples);
+    s->samples = NULL;
+}
+
+GSTACK_DEF size_t gstack_samples(const gstack *s, gstack_sample *out, size_t max)
+{
+    if (!s->samples) {
+        return 0;
+    }
+
+    const size_t kept = s->sample_count < s->sample_cap ? s->sample_count : s->sample_cap;
+
+    if (!out) {
+        return kept;
+    }
+
+    const size_t n = kept < max ? kept : max;
+
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = s->samples[(s->sample_count - n + i) % s->sample_cap];
+    }
+
+    return n;
+}
+
+GSTACK_DEF bool gstack_sample_export(const gstack *s, FILE *out)
+{
+    static const char *const events[] = {
+        [GSTACK_SAMPLE_OP] = "op",
+        [GSTACK_SAMPLE_GROW] = "grow",
+        [GSTACK_SAMPLE_SHRINK] = "shrink"
+    };
+    const size_t n = gstack_samples(s, NULL, 0);
+
+    if (fputs("ns,size,cap,event\n", out) < 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        const gstack_sample *const sample =
+            &s->samples[(s->sample_count - n + i) % s->sample_cap];
+
+        if (fprintf(out, "%llu,%llu,%llu,%s\n", (unsigned long long) sample->ns,
+                    (unsigned long long) sample->size, (unsigned long long) sample->cap,
+                    events[sample->event]) < 0) {
+            return false;
+        }
+    }
+
+    return !ferror(out);
+}
+#endif                          /* GSTACK_SAMPLING */
+
+#ifdef GSTACK_HISTOGRAMS
+GSTACK_DEF bool gstack_track_resizes(gstack *s, bool on)
+{
+    if (!on) {
+        GSTACK_FREE(s->hists);
+        s->hists = NULL;
+        return true;
+    }
+
+    if (!s->hists && !(s->hists = GSTACK_MALLOC(sizeof *s->hists))) {
+        return false;
+    }
+
+    memset(s->hists, 0, sizeof *s->hists);
+    return true;
+}
+
+GSTACK_DEF bool gstack_resize_hists_of(const gstack *s, gstack_resize_hists *out)
+{
+    if (!s->hists) {
+        return false;
+    }
+
+    memcpy(out, s->hists, sizeof *out);
+    return true;
+}
+
+GSTACK_DEF void gstack_resize_hists_all(gstack_resize_hists *out)
+{
+    gstack_hists_acquire();
+    memcpy(out, &gstack_hists_global, sizeof *out);
+    gstack_hists_release();
+}
+
+GSTACK_DEF void gstack_resize_hists_reset_all(void)
+{
+    gstack_hists_acquire();
+    memset(&gstack_hists_global, 0, sizeof gstack_hists_global);
+    gstack_hists_release();
+}
+#endif                          /* GSTACK_HISTOGRAMS */
+
+#ifdef GSTACK_BUDGETS
+GSTACK_DEF gstack_budget *gstack_budget_create(size_t limit,
+                                               bool (*on_exceed)(gstack_budget *b, gstack *s,
+                                                                 size_t need, void *ctx),
+                                               void *ctx)
+{
+    gstack_budget *const b = GSTACK_MALLOC(sizeof *b);
+
+    if (b) {
+        atomic_init(&b->used, 0);
+        atomic_init(&b->limit, limit);
+        atomic_init(&b->peak, 0);
+        atomic_init(&b->failures, 0);
+        atomic_init(&b->stacks, 0);
+        b->on_exceed = on_exceed;
+        b->ctx = ctx;
+    }
+
+    return b;
+}
+
+GSTACK_DEF void gstack_budget_set_limit(gstack_budget *b, size_t limit)
+{
+    atomic_store_explicit(&b->limit, limit, memory_order_relaxed);
+}
+
+GSTACK_DEF bool gstack_budget_join(gstack *s, gstack_budget *b)
+{
+    if (s->budget) {
+        return false;
+    }
+
+    s->budget = b;
+
+    if (!gstack_budget_charge(s, gstack_footprint(s))) {
+        s->budget = NULL;
+        return false;
+    }
+
+    atomic_fetch_add_explicit(&b->stacks, 1, memory_order_relaxed);
+    return true;
+}
+
+GSTACK_DEF gstack_budget *gstack_budget_of(const gstack *s)
+{
+    return s->budget;
+}
+
+GSTACK_DEF void gstack_budget_query(const gstack_budget *b, gstack_budget_usage *out)
+{
+    /* The fields are read one at a time, so they may be slightly out of step. */
+    out->used = atomic_load_explicit(&b->used, memory_order_relaxed);
+    out->limit = atomic_load_explicit(&b->limit, memory_order_relaxed);
+    out->peak = atomic_load_explicit(&b->peak, memory_order_relaxed);
+    out->failures = atomic_load_explicit(&b->failures, memory_order_relaxed);
+    out->stacks = atomic_load_explicit(&b->stacks, memory_order_relaxed);
+}
+
+GSTACK_DEF bool gstack_budget_destroy(gstack_budget *b)
+{
+    if (atomic_load_explicit(&b->stacks, memory_order_relaxed) != 0) {
+        return false;
+    }
+
+    GSTACK_FREE(b);
+    return true;
+}
+#endif                          /* GSTACK_BUDGETS */
+
+#define GSTACK_SYMTAB_NONE      SIZE_MAX
+
+struct gstack_symtab_binding {
+    const char *name;
+    void *value;
+    size_t hash;
+    size_t shadow;          /* Log index of the shadowed binding, or GSTACK_SYMTAB_NONE. */
+};
+
+struct gstack_symtab {
+    gstack *log;            /* All live bindings, oldest first. */
+    gstack *scopes;         /* A mark of the log for every open scope. */
+    size_t *index;          /* Log index + 1 of the newest binding of a name, or 0. */
+    size_t index_cap;       /* Always a power of two. */
+    size_t index_count;
+};
+
+static size_t gstack_symtab_hash(const char *name)
+{
+    /* FNV-1a. */
+    uint64_t h = 14695981039346656037u;
+
+    for (const unsigned char *p = (const unsigned char *) name; *p; ++p) {
+        h ^= *p;
+        h *= 1099511628211u;
+    }
+
+    return (size_t) h;
+}
+
+static struct gstack_symtab_binding *gstack_symtab_at(const gstack_symtab *t, size_t i)
+{
+    return (struct gstack_symtab_binding *) t->log->data + i;
+}
+
+/* Returns the slot of the index that holds `name`, or the empty slot where it
+ * would be inserted.
+ */
+static size_t gstack_symtab_find(const gstack_symtab *t, const char *name, size_t hash)
+{
+    const size_t mask = t->index_cap - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        if (t->index[i] == 0) {
+            return i;
+        }
+
+        const struct gstack_symtab_binding *const b = gstack_symtab_at(t, t->index[i] - 1);
+
+        if (b->hash == hash && strcmp(b->name, name) == 0) {
+            return i;
+        }
+    }
+}
+
+static bool gstack_symtab_grow_index(gstack_symtab *t)
+{
+    if (t->index_cap > SIZE_MAX / 2 / sizeof *t->index) {
+        return false;
+    }
+
+    const size_t new_cap = t->index_cap * 2;
+    const size_t mask = new_cap - 1;
+    size_t *const new_index = GSTACK_MALLOC(new_cap * sizeof *new_index);
+
+    if (!new_index) {
+        return false;
+    }
+
+    memset(new_index, 0, new_cap * sizeof *new_index);
+
+    for (size_t i = 0; i < t->index_cap; ++i) {
+        if (t->index[i] == 0) {
+            continue;
+        }
+
+        size_t j = gstack_symtab_at(t, t->index[i] - 1)->hash & mask;
+
+        while (new_index[j]) {
+            j = (j + 1) & mask;
+        }
+        new_index[j] = t->index[i];
+    }
+
+    GSTACK_FREE(t->index);
+    t->index = new_index;
+    t->index_cap = new_cap;
+    return true;
+}
+
+/* Empties slot `i` of the index. As it uses linear probing, the entries that
+ * follow in the same cluster are shifted back so that none of them becomes
+ * unreachable.
+ */
+static void gstack_symtab_unindex(gstack_symtab *t, size_t i)
+{
+    const size_t mask = t->index_cap - 1;
+
+    for (size_t j = (i + 1) & mask; t->index[j]; j = (j + 1) & mask) {
+        const size_t home = gstack_symtab_at(t, t->index[j] - 1)->hash & mask;
+        const bool in_place = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+
+        if (!in_place) {
+            t->index[i] = t->index[j];
+            i = j;
+        }
+    }
+
+    t->index[i] = 0;
+    --t->index_count;
+}
+
+GSTACK_DEF gstack_symtab *gstack_symtab_create(size_t cap)
+{
+    gstack_symtab *const t = GSTACK_MALLOC(sizeof *t);
+
+    if (!t) {
+        return NULL;
+    }
+
+    t->index_cap = 16;
+    t->index_count = 0;
+    t->log = gstack_create_internal(cap ? cap : 1, sizeof (struct gstack_symtab_binding));
+    t->scopes = gstack_create_internal(16, sizeof (size_t));
+    t->index = GSTACK_MALLOC(t->index_cap * sizeof *t->index);
+
+    if (!t->log || !t->scopes || !t->index) {
+        if (t->log) {
+            gstack_destroy(t->log);
+        }
+        if (t->scopes) {
+            gstack_destroy(t->scopes);
+        }
+        GSTACK_FREE(t->index);
+        GSTACK_FREE(t);
+        return NULL;
+    }
+
+    memset(t->index, 0, t->index_cap * sizeof *t->index);
+    return t;
+}
+
+GSTACK_DEF bool gstack_symtab_bind(gstack_symtab *t, const char *name, void *value)
+{
+    /* Keep the load factor at or under one-half. */
+    if ((t->index_count + 1) > t->index_cap / 2 && !gstack_symtab_grow_index(t)) {
+        return false;
+    }
+
+    const size_t hash = gstack_symtab_hash(name);
+    const size_t slot = gstack_symtab_find(t, name, hash);
+    const struct gstack_symtab_binding b = {
+        .name = name,
+        .value = value,
+        .hash = hash,
+        .shadow = t->index[slot] ? t->index[slot] - 1 : GSTACK_SYMTAB_NONE
+    };
+
+    if (!gstack_push(t->log, &b)) {
+        return false;
+    }
+
+    if (t->index[slot] == 0) {
+        ++t->index_count;
+    }
+
+    t->index[slot] = gstack_size(t->log);
+    return true;
+}
+
+GSTACK_DEF void *gstack_symtab_lookup(const gstack_symtab *t, const char *name)
+{
+    const size_t slot = gstack_symtab_find(t, name, gstack_symtab_hash(name));
+
+    return t->index[slot] ? gstack_symtab_at(t, t->index[slot] - 1)->value : NULL;
+}
+
+GSTACK_DEF void *gstack_symtab_lookup_local(const gstack_symtab *t, const char *name)
+{
+    const size_t slot = gstack_symtab_find(t, name, gstack_symtab_hash(name));
+    const size_t scope_start = gstack_is_empty(t->scopes) ? 0
+                                : *(const size_t *) gstack_peek(t->scopes);
+
+    if (t->index[slot] == 0 || t->index[slot] - 1 < scope_start) {
+        return NULL;
+    }
+
+    return gstack_symtab_at(t, t->index[slot] - 1)->value;
+}
+
+GSTACK_DEF bool gstack_symtab_enter(gstack_symtab *t)
+{
+    const size_t mark = gstack_mark(t->log);
+
+    return gstack_push(t->scopes, &mark);
+}
+
+GSTACK_DEF bool gstack_symtab_leave(gstack_symtab *t)
+{
+    if (gstack_is_empty(t->scopes)) {
+        return false;
+    }
+
+    const size_t mark = *(const size_t *) gstack_pop(t->scopes);
+
+    /* Undo the bindings newest first, so that every one of them is still the
+     * newest binding of its name when we get to it.
+     */
+    for (size_t i = gstack_size(t->log); i-- > mark;) {
+        const struct gstack_symtab_binding *const b = gstack_symtab_at(t, i);
+        const size_t slot = gstack_symtab_find(t, b->name, b->hash);
+
+        if (b->shadow != GSTACK_SYMTAB_NONE) {
+            t->index[slot] = b->shadow + 1;
+        } else {
+            gstack_symtab_unindex(t, slot);
+        }
+    }
+
+    gstack_rewind(t->log, mark);
+    return true;
+}
+
+GSTACK_DEF size_t gstack_symtab_depth(const gstack_symtab *t)
+{
+    return gstack_size(t->scopes);
+}
+
+GSTACK_DEF void gstack_symtab_destroy(gstack_symtab *t)
+{
+    gstack_destroy(t->log);
+    gstack_destroy(t->scopes);
+    GSTACK_FREE(t->index);
+    GSTACK_FREE(t);
+}
+
+struct gstack_roots {
+    gstack *slots;          /* The roots, always in contiguous storage. */
+    gstack *frames;         /* A mark of `slots` for every open frame. */
+};
+
+GSTACK_DEF gstack_roots *gstack_roots_create(size_t cap)
+{
+    gstack_roots *const r = GSTACK_MALLOC(sizeof *r);
+
+    if (!r) {
+        return NULL;
+    }
+
+    r->slots = gstack_create_internal(cap ? cap : 1, sizeof (void *));
+    r->frames = gstack_create_internal(16, sizeof (size_t));
+
+    if (!r->slots || !r->frames) {
+        if (r->slots) {
+            gstack_destroy(r->slots);
+        }
+        if (r->frames) {
+            gstack_destroy(r->frames);
+        }
+        GSTACK_FREE(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+GSTACK_DEF bool gstack_roots_enter(gstack_roots *r)
+{
+    const size_t mark = gstack_mark(r->slots);
+
+    return gstack_push(r->frames, &mark);
+}
+
+GSTACK_DEF bool gstack_roots_leave(gstack_roots *r)
+{
+    const size_t *const mark = gstack_pop(r->frames);
+
+    return mark && gstack_rewind(r->slots, *mark);
+}
+
+GSTACK_DEF bool gstack_roots_push(gstack_roots *r, void *p)
+{
+    return gstack_push(r->slots, &p);
+}
+
+GSTACK_DEF void **gstack_roots_at(const gstack_roots *r, size_t index)
+{
+    return index < r->slots->size ? (void **) r->slots->data + index : NULL;
+}
+
+GSTACK_DEF void **gstack_roots_scan(const gstack_roots *r, size_t *count)
+{
+    *count = r->slots->size;
+    return r->slots->data;
+}
+
+GSTACK_DEF void gstack_roots_update(gstack_roots *r, void *(*forward)(void *, void *), void *ctx)
+{
+    void **const roots = r->slots->data;
+
+    for (size_t i = 0, n = r->slots->size; i < n; ++i) {
+        if (roots[i]) {
+            roots[i] = forward(roots[i], ctx);
+        }
+    }
+}
+
+GSTACK_DEF size_t gstack_roots_size(const gstack_roots *r)
+{
+    return gstack_size(r->slots);
+}
+
+GSTACK_DEF size_t gstack_roots_depth(const gstack_roots *r)
+{
+    return gstack_size(r->frames);
+}
+
+GSTACK_DEF void gstack_roots_destroy(gstack_roots *r)
+{
+    gstack_destroy(r->slots);
+    gstack_destroy(r->frames);
+    GSTACK_FREE(r);
+}
+
+/* A node of a gstack_prio is the index of the node below it in its level, or of
+ * the next free node, followed by the element at offset
+ * sizeof (union gstack_max_align), so that it is aligned.
+ */
+#define GSTACK_PRIO_NONE        SIZE_MAX
+
+struct gstack_prio {
+    gstack *nodes;          /* Of all the levels, and the free ones. */
+    size_t *heads;          /* The newest node of every level. */
+    size_t *sizes;
+    size_t free;            /* A list of the nodes popped, newest first. */
+    size_t size;
+    size_t memb_size;
+    uint64_t occupied;      /* Bit l is set iff level l is not empty. */
+    unsigned levels;
+};
+
+/* Returns the highest level set in `occupied`, which must not be 0. */
+static unsigned gstack_prio_top(uint64_t occupied)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - (unsigned) __builtin_clzll(occupied);
+#else
+    unsigned n = 0;
+
+    while (occupied >>= 1) {
+        ++n;
+    }
+    return n;
+#endif
+}
+
+static size_t *gstack_prio_link(const gstack_prio *p, size_t node)
+{
+    return (size_t *) ((char *) p->nodes->data + node * p->nodes->memb_size);
+}
+
+static void *gstack_prio_elem(const gstack_prio *p, size_t node)
+{
+    return (char *) gstack_prio_link(p, node) + sizeof (union gstack_max_align);
+}
+
+GSTACK_DEF gstack_prio *gstack_prio_create(unsigned levels, size_t memb_size)
+{
+    const size_t align = sizeof (union gstack_max_align);
+
+    if (levels == 0 || levels > GSTACK_PRIO_MAX_LEVELS || memb_size == 0
+        || memb_size > SIZE_MAX - 2 * align) {
+        return NULL;
+    }
+
+    gstack_prio *const p = GSTACK_MALLOC(sizeof *p);
+
+    if (!p) {
+        return NULL;
+    }
+
+    p->nodes = gstack_create_internal(16, align + (memb_size + align - 1) / align * align);
+    p->heads = GSTACK_MALLOC(levels * sizeof *p->heads);
+    p->sizes = GSTACK_MALLOC(levels * sizeof *p->sizes);
+
+    if (!p->nodes || !p->heads || !p->sizes) {
+        if (p->nodes) {
+            gstack_destroy(p->nodes);
+        }
+        GSTACK_FREE(p->heads);
+        GSTACK_FREE(p->sizes);
+        GSTACK_FREE(p);
+        return NULL;
+    }
+
+    for (unsigned l = 0; l < levels; ++l) {
+        p->heads[l] = GSTACK_PRIO_NONE;
+        p->sizes[l] = 0;
+    }
+
+    p->free = GSTACK_PRIO_NONE;
+    p->size = 0;
+    p->memb_size = memb_size;
+    p->occupied = 0;
+    p->levels = levels;
+    return p;
+}
+
+GSTACK_DEF bool gstack_prio_push(gstack_prio *p, unsigned level, const void *data)
+{
+    size_t node = p->free;
+
+    if (level >= p->levels) {
+        return false;
+    }
+
+    if (node != GSTACK_PRIO_NONE) {
+        p->free = *gstack_prio_link(p, node);
+    } else {
+        node = p->nodes->size;
+
+        if (!gstack_push_slot(p->nodes)) {
+            return false;
+        }
+    }
+
+    *gstack_prio_link(p, node) = p->heads[level];
+    memcpy(gstack_prio_elem(p, node), data, p->memb_size);
+    p->heads[level] = node;
+    ++p->sizes[level];
+    ++p->size;
+    p->occupied |= (uint64_t) 1 << level;
+    return true;
+}
+
+GSTACK_DEF bool gstack_prio_pop(gstack_prio *p, void *out, unsigned *level)
+{
+    if (!p->occupied) {
+        return false;
+    }
+
+    const unsigned l = gstack_prio_top(p->occupied);
+    const size_t node = p->heads[l];
+    size_t *const link = gstack_prio_link(p, node);
+
+    memcpy(out, gstack_prio_elem(p, node), p->memb_size);
+    p->heads[l] = *link;
+    *link = p->free;
+    p->free = node;
+    --p->size;
+
+    if (--p->sizes[l] == 0) {
+        p->occupied &= ~((uint64_t) 1 << l);
+    }
+
+    if (level) {
+        *level = l;
+    }
+
+    return true;
+}
+
+GSTACK_DEF const void *gstack_prio_peek(const gstack_prio *p, unsigned *level)
+{
+    if (!p->occupied) {
+        return NULL;
+    }
+
+    const unsigned l = gstack_prio_top(p->occupied);
+
+    if (level) {
+        *level = l;
+    }
+
+    return gstack_prio_elem(p, p->heads[l]);
+}
+
+GSTACK_DEF size_t gstack_prio_size(const gstack_prio *p)
+{
+    return p->size;
+}
+
+GSTACK_DEF size_t gstack_prio_level_size(const gstack_prio *p, unsigned level)
+{
+    return level < p->levels ? p->sizes[level] : 0;
+}
+
+GSTACK_DEF void gstack_prio_destroy(gstack_prio *p)
+{
+    gstack_destroy(p->nodes);
+    GSTACK_FREE(p->heads);
+    GSTACK_FREE(p->sizes);
+    GSTACK_FREE(p);
+}
+
+#ifdef GSTACK_DURABLE
+enum { GSTACK_DURABLE_PUSH = 1, GSTACK_DURABLE_POP = 2 };
+
+/* Followed by `len` bytes of the element pushed. */
+struct gstack_durable_record {
+    uint64_t seq;
+    uint64_t check;         /* Of the other fields and of the element. */
+    uint32_t op;
+    uint32_t len;
+};
+
+struct gstack_durable_snapshot {
+    char magic[8];
+    uint64_t seq;           /* Of the newest record it includes. */
+    uint64_t memb_size;
+    uint64_t count;
+    uint64_t check;         /* Of the elements. */
+};
+
+static const char gstack_durable_magic[8] = "gstack\0\1";
+
+struct gstack_durable {
+    gstack *stack;
+    int fd;                 /* The log, opened for appending. */
+    char *snap_path;
+    char *tmp_path;         /* Where the next snapshot is written before it is renamed. */
+    size_t path_len;        /* Of the log. */
+    gstack_durable_opts opts;
+
+    /* The records not committed yet. */
+    unsigned char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    size_t pending_count;
+    uint64_t pending_since;
+
+    uint64_t seq;           /* Of the newest record. */
+    uint64_t committed;
+    size_t log_len;         /* The committed bytes in the log. */
+};
+
+/* FNV-1a, continued from `h`. */
+static uint64_t gstack_durable_hash(uint64_t h, const void *data, size_t len)
+{
+    for (const unsigned char *p = data; len--; ++p) {
+        h ^= *p;
+        h *= 1099511628211u;
+    }
+    return h;
+}
+
+static uint64_t gstack_durable_check(const struct gstack_durable_record *r, const void *elem)
+{
+    uint64_t h = 14695981039346656037u;
+
+    h = gstack_durable_hash(h, &r->seq, sizeof r->seq);
+    h = gstack_durable_hash(h, &r->op, sizeof r->op);
+    h = gstack_durable_hash(h, &r->len, sizeof r->len);
+    return gstack_durable_hash(h, elem, r->len);
+}
+
+static bool gstack_durable_read(int fd, void *buf, size_t len)
+{
+    for (size_t done = 0; done < len;) {
+        const ssize_t n = read(fd, (char *) buf + done, len - done);
+
+        if (n == 0 || (n < 0 && errno != EINTR)) {
+            return false;
+        }
+        done += n > 0 ? (size_t) n : 0;
+    }
+    return true;
+}
+
+static bool gstack_durable_write(int fd, const void *buf, size_t len)
+{
+    for (size_t done = 0; done < len;) {
+        const ssize_t n = write(fd, (const char *) buf + done, len - done);
+
+        if (n < 0 && errno != EINTR) {
+            return false;
+        }
+        done += n > 0 ? (size_t) n : 0;
+    }
+    return true;
+}
+
+/* Loads the snapshot, if any, and returns the sequence number of its newest
+ * record through `seq`.
+ */
+static bool gstack_durable_load(gstack_durable *d, uint64_t *seq)
+{
+    struct gstack_durable_snapshot snap;
+    const int fd = open(d->snap_path, O_RDONLY);
+
+    *seq = 0;
+
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+
+    bool ok = gstack_durable_read(fd, &snap, sizeof snap)
+        && memcmp(snap.magic, gstack_durable_magic, sizeof snap.magic) == 0
+        && snap.memb_size == d->stack->memb_size
+        && snap.count <= SIZE_MAX / snap.memb_size
+        && gstack_reserve(d->stack, (size_t) snap.count)
+        && gstack_durable_read(fd, d->stack->data, (size_t) snap.count * d->stack->memb_size);
+
+    if (ok) {
+        const uint64_t check = gstack_durable_hash(14695981039346656037u, d->stack->data,
+                                                   (size_t) snap.count * d->stack->memb_size);
+
+        ok = check == snap.check;
+        d->stack->size = (size_t) snap.count;
+        *seq = snap.seq;
+    }
+
+    close(fd);
+    return ok;
+}
+
+/* Replays the records of the log newer than `since`, and cuts off the torn or
+ * corrupt ones at its end.
+ */
+static bool gstack_durable_replay(gstack_durable *d, uint64_t since)
+{
+    const size_t memb_size = d->stack->memb_size;
+    unsigned char *const elem = GSTACK_MALLOC(memb_size);
+    struct gstack_durable_record r;
+    uint64_t last = 0;
+    size_t len = 0;
+
+    if (!elem) {
+        return false;
+    }
+
+    d->seq = since;
+
+    while (gstack_durable_read(d->fd, &r, sizeof r)) {
+        if (!(r.op == GSTACK_DURABLE_PUSH && r.len == memb_size)
+            && !(r.op == GSTACK_DURABLE_POP && r.len == 0)) {
+            break;
+        }
+
+        if ((r.len && !gstack_durable_read(d->fd, elem, r.len))
+            || r.check != gstack_durable_check(&r, elem) || r.seq <= last) {
+            break;
+        }
+
+        if (r.seq > since) {
+            if (r.op == GSTACK_DURABLE_PUSH ? !gstack_push(d->stack, elem)
+                                            : !gstack_pop(d->stack)) {
+                break;
+            }
+            d->seq = r.seq;
+        }
+
+        last = r.seq;
+        len += sizeof r + r.len;
+    }
+
+    GSTACK_FREE(elem);
+    d->log_len = len;
+    d->committed = d->seq;
+    return ftruncate(d->fd, (off_t) len) == 0 && lseek(d->fd, 0, SEEK_END) >= 0;
+}
+
+GSTACK_DEF gstack_durable *gstack_durable_open(const char *path, size_t memb_size,
+                                               const gstack_durable_opts *opts)
+{
+    static const gstack_durable_opts defaults = {
+        64, (size_t) 1 << 20, 10000000u, (size_t) 64 << 20
+    };
+    const size_t path_len = strlen(path);
+    gstack_durable *const d = GSTACK_MALLOC(sizeof *d);
+
+    if (!d) {
+        return NULL;
+    }
+
+    d->snap_path = GSTACK_MALLOC(path_len + sizeof ".snap");
+    d->tmp_path = GSTACK_MALLOC(path_len + sizeof ".snap.tmp");
+    d->stack = gstack_create_internal(16, memb_size);
+    d->fd = -1;
+
+    if (!d->snap_path || !d->tmp_path || !d->stack || memb_size > UINT32_MAX) {
+        goto fail;
+    }
+
+    memcpy(d->snap_path, path, path_len);
+    memcpy(d->snap_path + path_len, ".snap", sizeof ".snap");
+    memcpy(d->tmp_path, path, path_len);
+    memcpy(d->tmp_path + path_len, ".snap.tmp", sizeof ".snap.tmp");
+    d->path_len = path_len;
+    d->opts = opts ? *opts : defaults;
+    d->pending = NULL;
+    d->pending_len = d->pending_cap = d->pending_count = 0;
+
+    uint64_t since;
+
+    if (!gstack_durable_load(d, &since)
+        || (d->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0
+        || !gstack_durable_replay(d, since)) {
+        goto fail;
+    }
+
+    return d;
+
+fail:
+    if (d->fd >= 0) {
+        close(d->fd);
+    }
+    if (d->stack) {
+        gstack_destroy(d->stack);
+    }
+    GSTACK_FREE(d->snap_path);
+    GSTACK_FREE(d->tmp_path);
+    GSTACK_FREE(d);
+    return NULL;
+}
+
+/* Appends a record to the pending group. */
+static bool gstack_durable_append(gstack_durable *d, uint32_t op, const void *elem)
+{
+    const uint32_t len = op == GSTACK_DURABLE_PUSH ? (uint32_t) d->stack->memb_size : 0;
+    const size_t need = d->pending_len + sizeof (struct gstack_durable_record) + len;
+
+    if (need > d->pending_cap) {
+        size_t new_cap = d->pending_cap ? d->pending_cap : 4096;
+
+        while (new_cap < need) {
+            new_cap *= 2;
+        }
+
+        unsigned char *const tmp = GSTACK_REALLOC(d->pending, new_cap);
+
+        if (!tmp) {
+            return false;
+        }
+
+        d->pending = tmp;
+        d->pending_cap = new_cap;
+    }
+
+    struct gstack_durable_record r = { d->seq + 1, 0, op, len };
+
+    r.check = gstack_durable_check(&r, elem);
+    memcpy(d->pending + d->pending_len, &r, sizeof r);
+    if (len) {
+        memcpy(d->pending + d->pending_len + sizeof r, elem, len);
+    }
+
+    if (d->pending_count++ == 0) {
+        d->pending_since = d->opts.group_ns ? gstack_now_ns() : 0;
+    }
+
+    d->pending_len = need;
+    ++d->seq;
+    return true;
+}
+
+static bool gstack_durable_due(const gstack_durable *d)
+{
+    const gstack_durable_opts *const o = &d->opts;
+
+    return (o->group_count && d->pending_count >= o->group_count)
+        || (o->group_bytes && d->pending_len >= o->group_bytes)
+        || (o->group_ns && gstack_now_ns() - d->pending_since >= o->group_ns);
+}
+
+GSTACK_DEF bool gstack_durable_push(gstack_durable *d, const void *data, uint64_t *seq)
+{
+    if (!gstack_push(d->stack, data)) {
+        return false;
+    }
+
+    if (!gstack_durable_append(d, GSTACK_DURABLE_PUSH, data)) {
+        (void) gstack_pop(d->stack);
+        return false;
+    }
+
+    if (seq) {
+        *seq = d->seq;
+    }
+
+    return !gstack_durable_due(d) || gstack_durable_commit(d);
+}
+
+GSTACK_DEF bool gstack_durable_pop(gstack_durable *d, void *out, uint64_t *seq)
+{
+    const void *const top = gstack_peek(d->stack);
+
+    if (!top || !gstack_durable_append(d, GSTACK_DURABLE_POP, NULL)) {
+        return false;
+    }
+
+    memcpy(out, top, d->stack->memb_size);
+    (void) gstack_pop(d->stack);
+
+    if (seq) {
+        *seq = d->seq;
+    }
+
+    return !gstack_durable_due(d) || gstack_durable_commit(d);
+}
+
+GSTACK_DEF const void *gstack_durable_peek(const gstack_durable *d)
+{
+    return gstack_peek(d->stack);
+}
+
+GSTACK_DEF size_t gstack_durable_size(const gstack_durable *d)
+{
+    return gstack_size(d->stack);
+}
+
+GSTACK_DEF uint64_t gstack_durable_committed(const gstack_durable *d)
+{
+    return d->committed;
+}
+
+GSTACK_DEF bool gstack_durable_commit(gstack_durable *d)
+{
+    if (d->pending_count) {
+        if (!gstack_durable_write(d->fd, d->pending, d->pending_len)
+            || GSTACK_DATASYNC(d->fd) != 0) {
+            /* Do not leave a partial group for the next one to follow. */
+            (void) ftruncate(d->fd, (off_t) d->log_len);
+            return false;
+        }
+
+        d->log_len += d->pending_len;
+        d->committed = d->seq;
+        d->pending_len = d->pending_count = 0;
+    }
+
+    if (d->opts.compact_bytes && d->log_len >= d->opts.compact_bytes) {
+        return gstack_durable_compact(d);
+    }
+
+    return true;
+}
+
+GSTACK_DEF bool gstack_durable_wait(gstack_durable *d, uint64_t seq)
+{
+    return seq <= d->committed || gstack_durable_commit(d);
+}
+
+/* Makes the last rename in the directory of `path` durable. */
+static bool gstack_durable_sync_dir(const char *path, size_t len)
+{
+    while (len > 0 && path[len - 1] != '/') {
+        --len;
+    }
+
+    if (len == 0) {
+        path = ".";
+        len = 1;
+    }
+
+    char *const dir = GSTACK_MALLOC(len + 1);
+
+    if (!dir) {
+        return false;
+    }
+
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+
+    const int fd = open(dir, O_RDONLY);
+
+    GSTACK_FREE(dir);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    const bool ok = fsync(fd) == 0;
+
+    close(fd);
+    return ok;
+}
+
+GSTACK_DEF bool gstack_durable_compact(gstack_durable *d)
+{
+    const size_t bytes = d->stack->size * d->stack->memb_size;
+    struct gstack_durable_snapshot snap;
+
+    /* The log must hold nothing the snapshot does not, for it to be emptied. */
+    if (d->pending_count) {
+        const size_t limit = d->opts.compact_bytes;
+        bool ok;
+
+        d->opts.compact_bytes = 0;
+        ok = gstack_durable_commit(d);
+        d->opts.compact_bytes = limit;
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    memcpy(snap.magic, gstack_durable_magic, sizeof snap.magic);
+    snap.seq = d->seq;
+    snap.memb_size = d->stack->memb_size;
+    snap.count = d->stack->size;
+    snap.check = gstack_durable_hash(14695981039346656037u, d->stack->data, bytes);
+
+    const int fd = open(d->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0
+        && gstack_durable_write(fd, &snap, sizeof snap)
+        && gstack_durable_write(fd, d->stack->data, bytes)
+        && GSTACK_DATASYNC(fd) == 0;
+
+    if (fd >= 0) {
+        ok = close(fd) == 0 && ok;
+    }
+
+    ok = ok && rename(d->tmp_path, d->snap_path) == 0
+        && gstack_durable_sync_dir(d->snap_path, d->path_len);
+
+    if (!ok) {
+        (void) remove(d->tmp_path);
+        return false;
+    }
+
+    /* A crash before the log is emptied leaves records the snapshot already
+     * includes, which the replay skips by their sequence numbers.
+     */
+    if (ftruncate(d->fd, 0) != 0 || GSTACK_DATASYNC(d->fd) != 0) {
+        return false;
+    }
+
+    d->log_len = 0;
+    return true;
+}
+
+GSTACK_DEF bool gstack_durable_close(gstack_durable *d)
+{
+    const bool ok = gstack_durable_commit(d);
+
+    close(d->fd);
+    gstack_destroy(d->stack);
+    GSTACK_FREE(d->pending);
+    GSTACK_FREE(d->snap_path);
+    GSTACK_FREE(d->tmp_path);
+    GSTACK_FREE(d);
+    return ok;
+}
+#endif                          /* GSTACK_DURABLE */
+
+static unsigned gstack_hist_index(uint64_t value)
+{
+    if (value < (1u << GSTACK_HIST_SUB_BITS)) {
+        return (unsigned) value;
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    const unsigned msb = 63 - (unsigned) __builtin_clzll(value);
+#else
+    unsigned msb = 0;
+
+    while (value >> msb > 1) {
+        ++msb;
+    }
+#endif
+
+    const unsigned shift = msb - GSTACK_HIST_SUB_BITS;
+    const unsigned sub = (unsigned) (value >> shift) & ((1u << GSTACK_HIST_SUB_BITS) - 1);
+
+    return ((shift + 1) << GSTACK_HIST_SUB_BITS) + sub;
+}
+
+/* Returns the greatest value that falls in bucket `i`. */
+static uint64_t gstack_hist_bound(unsigned i)
+{
+    if (i < (2u << GSTACK_HIST_SUB_BITS)) {
+        return i;
+    }
+
+    const unsigned shift = (i >> GSTACK_HIST_SUB_BITS) - 1;
+    const uint64_t sub = i & ((1u << GSTACK_HIST_SUB_BITS) - 1);
+
+    return (((1u << GSTACK_HIST_SUB_BITS) + sub) << shift) + (((uint64_t) 1 << shift) - 1);
+}
+
+GSTACK_DEF void gstack_hist_record(gstack_hist *h, uint64_t value)
+{
+    ++h->buckets[gstack_hist_index(value)];
+    ++h->count;
+    h->sum += value;
+
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+GSTACK_DEF uint64_t gstack_hist_percentile(const gstack_hist *h, double pct)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+
+    const double wanted = (double) h->count * pct / 100.0;
+    uint64_t seen = 0;
+
+    for (unsigned i = 0; i < GSTACK_HIST_BUCKETS; ++i) {
+        seen += h->buckets[i];
+
+        if (seen > 0 && (double) seen >= wanted) {
+            const uint64_t bound = gstack_hist_bound(i);
+            return bound < h->max ? bound : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+#ifdef GSTACK_HAS_ATOMICS
+struct gstack_sync {
+    gstack *stack;
+
+    /* 0 if unlocked, 1 if locked, and 2 if locked with threads parked. */
+    atomic_uint state;
+
+    /* The statistics are only touched with the lock held. `track` can be
+     * read without it to know whether to time an acquisition.
+     */
+    atomic_bool track;
+    uint64_t acquired_at;
+    gstack_lock_stats stats;
+};
+
+static void gstack_sync_park(gstack_sync *s)
+{
+#ifdef GSTACK_HAS_FUTEX
+    /* Returns at once if the state is no longer 2, so no wakeup is lost. */
+    syscall(SYS_futex, (unsigned *) &s->state, FUTEX_WAIT_PRIVATE, 2u, NULL, NULL, 0);
+#elif !defined(__STDC_NO_THREADS__)
+    (void) s;
+    thrd_yield();
+#else
+    (void) s;
+    GSTACK_PAUSE();
+#endif
+}
+
+static void gstack_sync_unpark(gstack_sync *s)
+{
+#ifdef GSTACK_HAS_FUTEX
+    syscall(SYS_futex, (unsigned *) &s->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void) s;
+#endif
+}
+
+/* Spins, then parks, until it takes the lock. Returns whether it parked. */
+static bool gstack_sync_lock_slow(gstack_sync *s)
+{
+    for (unsigned round = 0; round < GSTACK_SPIN_LIMIT; ++round) {
+        for (unsigned i = 1u << (round < 6 ? round : 6); i > 0; --i) {
+            GSTACK_PAUSE();
+        }
+
+        unsigned expected = 0;
+
+        if (atomic_load_explicit(&s->state, memory_order_relaxed) == 0
+            && atomic_compare_exchange_weak_explicit(&s->state, &expected, 1,
+                                                     memory_order_acquire,
+                                                     memory_order_relaxed)) {
+            return false;
+        }
+    }
+
+    /* Whoever takes the lock now marks it as wanted by parked threads, as it
+     * cannot know whether it was the last of them.
+     */
+    while (atomic_exchange_explicit(&s->state, 2, memory_order_acquire) != 0) {
+        gstack_sync_park(s);
+    }
+
+    return true;
+}
+
+static void gstack_sync_lock(gstack_sync *s)
+{
+    unsigned expected = 0;
+    uint64_t waited = 0;
+    bool contended = false;
+    bool parked = false;
+
+    if (!atomic_compare_exchange_strong_explicit(&s->state, &expected, 1,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed)) {
+        const bool timed = atomic_load_explicit(&s->track, memory_order_relaxed);
+        const uint64_t start = timed ? gstack_now_ns() : 0;
+
+        contended = true;
+        parked = gstack_sync_lock_slow(s);
+        waited = timed ? gstack_now_ns() - start : 0;
+    }
+
+    if (!atomic_load_explicit(&s->track, memory_order_relaxed)) {
+        s->acquired_at = 0;
+        return;
+    }
+
+    ++s->stats.acquisitions;
+    s->stats.contended += contended;
+    s->stats.parked += parked;
+    gstack_hist_record(&s->stats.wait_ns, waited);
+    s->acquired_at = gstack_now_ns();
+}
+
+static void gstack_sync_unlock(gstack_sync *s)
+{
+    if (s->acquired_at != 0 && atomic_load_explicit(&s->track, memory_order_relaxed)) {
+        gstack_hist_record(&s->stats.hold_ns, gstack_now_ns() - s->acquired_at);
+    }
+
+    if (atomic_exchange_explicit(&s->state, 0, memory_order_release) == 2) {
+        gstack_sync_unpark(s);
+    }
+}
+
+GSTACK_DEF gstack_sync *gstack_sync_create(size_t cap, size_t memb_size)
+{
+    gstack_sync *const s = GSTACK_MALLOC(sizeof *s);
+
+    if (!s) {
+        return NULL;
+    }
+
+    s->stack = gstack_create_internal(cap, memb_size);
+
+    if (!s->stack) {
+        GSTACK_FREE(s);
+        return NULL;
+    }
+
+    atomic_init(&s->state, 0);
+    atomic_init(&s->track, false);
+    s->acquired_at = 0;
+    memset(&s->stats, 0, sizeof s->stats);
+    return s;
+}
+
+GSTACK_DEF bool gstack_sync_push(gstack_sync *s, const void *data)
+{
+    gstack_sync_lock(s);
+    const bool pushed = gstack_push(s->stack, data);
+    gstack_sync_unlock(s);
+    return pushed;
+}
+
+GSTACK_DEF bool gstack_sync_pop(gstack_sync *s, void *out)
+{
+    gstack_sync_lock(s);
+    const void *const top = gstack_pop(s->stack);
+
+    if (top) {
+        memcpy(out, top, s->stack->memb_size);
+    }
+
+    gstack_sync_unlock(s);
+    return top != NULL;
+}
+
+GSTACK_DEF bool gstack_sync_peek(gstack_sync *s, void *out)
+{
+    gstack_sync_lock(s);
+    const void *const top = gstack_peek(s->stack);
+
+    if (top) {
+        memcpy(out, top, s->stack->memb_size);
+    }
+
+    gstack_sync_unlock(s);
+    return top != NULL;
+}
+
+GSTACK_DEF size_t gstack_sync_size(gstack_sync *s)
+{
+    gstack_sync_lock(s);
+    const size_t size = gstack_size(s->stack);
+    gstack_sync_unlock(s);
+    return size;
+}
+
+GSTACK_DEF void gstack_sync_track(gstack_sync *s, bool on)
+{
+    gstack_sync_lock(s);
+
+    if (on && !atomic_load_explicit(&s->track, memory_order_relaxed)) {
+        memset(&s->stats, 0, sizeof s->stats);
+    }
+
+    atomic_store_explicit(&s->track, on, memory_order_relaxed);
+    s->acquired_at = 0;
+    gstack_sync_unlock(s);
+}
+
+GSTACK_DEF void gstack_sync_stats(gstack_sync *s, gstack_lock_stats *out)
+{
+    gstack_sync_lock(s);
+    memcpy(out, &s->stats, sizeof *out);
+    gstack_sync_unlock(s);
+}
+
+GSTACK_DEF void gstack_sync_destroy(gstack_sync *s)
+{
+    gstack_destroy(s->stack);
+    GSTACK_FREE(s);
+}
+#endif                          /* GSTACK_HAS_ATOMICS */
+
+#undef GSTACK_PROBE
+#undef GSTACK_DATASYNC
+#undef GSTACK_IOV_BATCH
+#undef GSTACK_READ_CHUNK
+#undef ATTRIB_COLD
+#undef ATTRIB_NONNULL
+#undef ATTRIB_WARN_UNUSED_RESULT       
+#undef ATTRIB_MALLOC                   
+
+#endif                          /* GSTACK_IMPLEMENTATION */
+
+#ifdef TEST_MAIN
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+#endif
+
+static void test_mark_rewind(void)
+{
+    gstack *const stack = gstack_create(4, sizeof (int));
+    assert(stack);
+
+    for (int i = 0; i < 10; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+
+    const size_t mark = gstack_mark(stack);
+
+    for (int i = 10; i < 100; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+
+    assert(gstack_rewind(stack, mark));
+    assert(gstack_size(stack) == 10);
+    assert(*(const int *) gstack_peek(stack) == 9);
+    assert(!gstack_rewind(stack, 11));
+    assert(gstack_rewind(stack, 0));
+    assert(gstack_is_empty(stack));
+    gstack_destroy(stack);
+}
+
+static void test_txn(void)
+{
+    gstack *const stack = gstack_create(4, sizeof (unsigned));
+    unsigned model[512];
+    size_t model_size = 0;
+    unsigned seed = 1;
+    assert(stack);
+    assert(!gstack_txn_commit(stack));
+
+    for (unsigned i = 0; i < 100; ++i) {
+        assert(gstack_push(stack, &i));
+        model[model_size++] = i;
+    }
+
+    for (int round = 0; round < 200; ++round) {
+        unsigned work[512];
+        size_t work_size = model_size;
+
+        memcpy(work, model, sizeof model);
+        assert(gstack_txn_begin(stack));
+        assert(!gstack_txn_begin(stack));
+
+        for (int op = 0; op < 50; ++op) {
+            seed = seed * 1103515245 + 12345;
+
+            const unsigned r = seed >> 16;
+
+            if (r % 3 == 0 && work_size < 400) {
+                assert(gstack_push(stack, &r));
+                work[work_size++] = r;
+            } else if (r % 3 == 1 && work_size) {
+                assert(*(unsigned *) gstack_pop(stack) == work[--work_size]);
+            } else {
+                const size_t mark = work_size - (work_size ? r % 8 % (work_size + 1) : 0);
+
+                assert(gstack_rewind(stack, mark));
+                work_size = mark;
+            }
+            assert(gstack_size(stack) == work_size);
+        }
+
+        if (round % 2) {
+            assert(gstack_txn_commit(stack));
+            memcpy(model, work, sizeof model);
+            model_size = work_size;
+        } else {
+            assert(gstack_txn_abort(stack));
+        }
+
+        assert(gstack_size(stack) == model_size);
+        assert(!gstack_txn_abort(stack));
+
+        for (size_t i = model_size; i-- > 0;) {
+            assert(*(unsigned *) gstack_pop(stack) == model[i]);
+        }
+        for (size_t i = 0; i < model_size; ++i) {
+            assert(gstack_push(stack, &model[i]));
+        }
+    }
+
+    gstack_destroy(stack);
+}
+
+static void test_trim(void)
+{
+    gstack *const stack = gstack_create(1024, sizeof (int));
+    assert(stack);
+
+    for (int i = 0; i < 400; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+
+    /* The allocator may round the capacity up. */
+    size_t released = gstack_trim(stack, 1.0);
+
+    assert(released && released <= (1024 - 800) * sizeof (int));
+    assert(gstack_trim(stack, 1.0) == 0);
+    released = gstack_trim(stack, 0.0);
+    assert(released && released <= 400 * sizeof (int));
+    assert(gstack_rewind(stack, 0));
+    assert(gstack_trim(stack, 0.0));
+
+    for (int i = 0; i < 10; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+
+    assert(*(const int *) gstack_peek(stack) == 9);
+    gstack_destroy(stack);
+
+#ifdef GSTACK_REGISTRY
+    gstack *const hot = gstack_create(1000, sizeof (int));
+    gstack *const cold = gstack_create(1000, sizeof (int));
+    assert(hot && cold);
+
+    for (int i = 0; i < 300; ++i) {
+        assert(gstack_push(hot, &i));
+        assert(gstack_push(cold, &i));
+    }
+
+    /* Both have just been used. */
+    assert(gstack_trim_all(0.0) == 0);
+    assert(gstack_push(hot, &(int) {300}));
+    released = gstack_trim_all(0.0);
+    assert(released && released <= 700 * sizeof (int));
+    released = gstack_trim_all(0.0);
+    assert(released && released <= 701 * sizeof (int));
+    assert(gstack_trim_if_rss_above(SIZE_MAX, 0.0) == 0);
+    gstack_destroy(hot);
+    gstack_destroy(cold);
+
+    /* The stacks of the other structures are not the registry's to trim. */
+    gstack_roots *const roots = gstack_roots_create(1);
+    size_t count;
+    assert(roots && gstack_roots_enter(roots));
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(gstack_roots_push(roots, &count));
+    }
+
+    void **const scan = gstack_roots_scan(roots, &count);
+    assert(gstack_trim_all(0.0) == 0 && gstack_trim_all(0.0) == 0);
+    assert(gstack_roots_scan(roots, &count) == scan && count == 1000);
+    gstack_roots_destroy(roots);
+
+#ifdef __linux__
+    assert(gstack_rss() > 0);
+#endif
+#endif                          /* GSTACK_REGISTRY */
+}
+
+#ifdef GSTACK_REGISTRY
+static void test_metrics(void)
+{
+    char text[4096], tiny[8];
+    gstack *const a = gstack_create(16, sizeof (int));
+    gstack *const b = gstack_create(16, sizeof (int));
+    gstack *const c = gstack_create(16, sizeof (int));
+    assert(a && b && c);
+
+    gstack_set_label(a, "parser");
+    gstack_set_label(b, "parser");
+    gstack_set_label(c, "say \"hi\"");
+
+    for (int i = 0; i < 100; ++i) {
+        assert(gstack_push(a, &i));
+    }
+
+    const size_t len = gstack_metrics_render(text, sizeof text);
+    assert(len > 0 && len < sizeof text && strlen(text) == len);
+    assert(gstack_metrics_render(tiny, sizeof tiny) == len);
+    assert(strlen(tiny) == sizeof tiny - 1);
+
+    assert(strstr(text, "# TYPE gstack_stacks gauge\n"));
+    assert(strstr(text, "\ngstack_stacks{label=\"parser\"} 2\n"));
+    assert(strstr(text, "\ngstack_stacks{label=\"say \\\"hi\\\"\"} 1\n"));
+    assert(strstr(text, "{label=\"parser\"} 2") < strstr(text, "{label=\"say"));
+    assert(strstr(text, "\ngstack_bytes_used{label=\"parser\"} 400\n"));
+    /* The capacity may have been rounded up to what the allocator gave. */
+    char slack[64];
+    snprintf(slack, sizeof slack, "\ngstack_bytes_slack{label=\"say \\\"hi\\\"\"} %zu\n",
+             (gstack_capacity(c) - gstack_size(c)) * sizeof (int));
+    assert(strstr(text, slack));
+    assert(strstr(text, "\ngstack_grows_total "));
+    assert(strstr(text, "\ngstack_shrinks_total "));
+
+#if defined(__unix__) || defined(__APPLE__)
+    char piped[sizeof text];
+    int fds[2];
+
+    assert(pipe(fds) == 0);
+    assert(gstack_metrics_write(fds[1]));
+    close(fds[1]);
+    assert(read(fds[0], piped, sizeof piped) == (ssize_t) len);
+    assert(memcmp(piped, text, len) == 0);
+    close(fds[0]);
+#endif
+
+    gstack_destroy(a);
+    gstack_destroy(b);
+    gstack_destroy(c);
+}
+#endif
+
+static void test_large(void)
+{
+    /* Crosses GSTACK_MMAP_THRESHOLD on the way up and back down. */
+    const size_t count = 4 * GSTACK_MMAP_THRESHOLD / sizeof (size_t);
+    gstack *const stack = gstack_create(1, sizeof (size_t));
+    assert(stack);
+
+    for (size_t i = 0; i < count; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+
+#ifdef GSTACK_HAS_MREMAP
+    assert(stack->mapped_len >= count * sizeof (size_t));
+#endif
+
+    for (size_t i = count; i-- > 1;) {
+        assert(*(size_t *) gstack_pop(stack) == i);
+    }
+
+    (void) gstack_trim(stack, 0.0);
+    assert(*(const size_t *) gstack_peek(stack) == 0);
+    gstack_destroy(stack);
+}
+
+static bool test_sum(const void *elem, void *ctx)
+{
+    *(size_t *) ctx += *(const size_t *) elem;
+    return true;
+}
+
+static bool test_stop_at_ten(const void *elem, void *ctx)
+{
+    (void) ctx;
+    return *(const size_t *) elem != 10;
+}
+
+/* Runs the same workload on a stack of size_t, whatever its backend. `bound` is
+ * the capacity it can not grow past, or SIZE_MAX.
+ */
+static void test_conformance(gstack *stack, size_t bound)
+{
+    const size_t count = bound < 50000 ? bound : 50000;
+    size_t sum = 0;
+
+    assert(stack);
+    assert(gstack_is_empty(stack));
+    assert(!gstack_peek(stack));
+    assert(!gstack_pop(stack));
+
+    for (size_t i = 0; i < count; ++i) {
+        assert(gstack_push(stack, &i));
+        assert(*(const size_t *) gstack_peek(stack) == i);
+    }
+
+    assert(gstack_push(stack, &sum) == (count < bound));
+
+    if (count < bound) {
+        assert(*(size_t *) gstack_pop(stack) == 0);
+    }
+
+    assert(gstack_size(stack) == count);
+    assert(gstack_capacity(stack) >= count);
+    assert(gstack_reserve(stack, 1000) == (count + 1000 <= bound));
+    assert(*(const size_t *) gstack_at(stack, count / 2) == count / 2);
+    assert(!gstack_at(stack, count));
+    assert(gstack_iterate(stack, test_sum, &sum));
+    assert(sum == count * (count - 1) / 2);
+    assert(!gstack_iterate(stack, test_stop_at_ten, NULL));
+
+    assert(gstack_txn_begin(stack));
+
+    for (size_t i = 0; i < count / 2; ++i) {
+        (void) gstack_pop(stack);
+    }
+
+    for (size_t i = 0; i < count / 4; ++i) {
+        assert(gstack_push(stack, &(size_t) {0}));
+    }
+
+    assert(gstack_txn_abort(stack));
+    (void) gstack_trim(stack, 0.5);
+
+    for (size_t i = count; i-- > 0;) {
+        assert(*(const size_t *) gstack_peek(stack) == i);
+        assert(*(size_t *) gstack_pop(stack) == i);
+    }
+
+    assert(gstack_is_empty(stack));
+    assert(gstack_push(stack, &sum));
+    gstack_destroy(stack);
+}
+
+static void test_backends(void)
+{
+    test_conformance(gstack_create(1, sizeof (size_t)), SIZE_MAX);
+
+#ifdef GSTACK_BACKENDS
+    for (gstack_backend b = 0; b < GSTACK_BACKEND_COUNT; ++b) {
+        const size_t bound = b == GSTACK_BOUNDED ? 3000 : SIZE_MAX;
+        gstack *const stack = gstack_create_with(b == GSTACK_BOUNDED ? bound : 3, sizeof (size_t), b, NULL);
+
+#ifndef GSTACK_HAS_MMAP
+        if (b == GSTACK_RESERVED || b == GSTACK_FILE) {
+            assert(!stack);
+            continue;
+        }
+#endif
+        assert(gstack_backend_of(stack) == b);
+        assert(gstack_backend_name(b));
+        test_conformance(stack, bound);
+    }
+
+    /* Big elements keep their address across growth, and a popped element's
+     * block is the next one pushed onto.
+     */
+    struct big { char bytes[3000]; } big = { { 1 } };
+    gstack *const indirect = gstack_create_with(1, sizeof big, GSTACK_INDIRECT, NULL);
+    assert(indirect);
+    assert(gstack_push(indirect, &big));
+
+    const void *const bottom = gstack_peek(indirect);
+
+    for (int i = 0; i < 100; ++i) {
+        big.bytes[0] = (char) i;
+        assert(gstack_push(indirect, &big));
+    }
+
+    assert(gstack_at(indirect, 0) == bottom);
+    assert(((const struct big *) gstack_at(indirect, 100))->bytes[0] == 99);
+
+    const void *const top = gstack_pop(indirect);
+    assert(gstack_push(indirect, &big));
+    assert(gstack_peek(indirect) == top);
+
+    /* The spare blocks are kept, so trimming only gives back their table. */
+    const size_t cap = gstack_capacity(indirect);
+    assert(cap > 101 && gstack_trim(indirect, 0.0) == (cap - 101) * sizeof (char *));
+
+    for (int i = 0; i < 100; ++i) {
+        (void) gstack_pop(indirect);
+    }
+
+    assert(gstack_peek(indirect) == bottom);
+    assert(((const struct big *) bottom)->bytes[0] == 1);
+    gstack_destroy(indirect);
+
+    assert(!gstack_create_with(1, 1, GSTACK_BACKEND_COUNT, NULL));
+    assert(!gstack_backend_name(GSTACK_BACKEND_COUNT));
+
+#ifdef GSTACK_HAS_MMAP
+    const size_t max = 100;
+
+    test_conformance(gstack_create_with(1, sizeof (size_t), GSTACK_RESERVED, &max),
+                     (size_t) sysconf(_SC_PAGESIZE) / sizeof (size_t));
+#endif
+#endif                          /* GSTACK_BACKENDS */
+}
+
+static void test_typed(void)
+{
+    gstack *const ints = gstack_create(1, sizeof (int));
+    gstack *const doubles = gstack_create(1, sizeof (double));
+    gstack *const ptrs = gstack_create(1, sizeof (void *));
+    assert(ints && doubles && ptrs);
+
+    assert(gstack_pop_int(ints) == 0);
+    assert(!gstack_push_double(ints, 1.0));
+    assert(!gstack_push_char(ints, 'a'));
+
+    /* Nor are elements of another size read or popped. */
+    assert(gstack_push_int(ints, 7));
+    assert(gstack_pop_double(ints) == 0 && gstack_peek_char(ints) == 0);
+    assert((gstack_pop_double)(ints) == 0 && (gstack_peek_llong)(ints) == 0);
+    assert(gstack_size(ints) == 1 && gstack_pop_int(ints) == 7);
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(gstack_push_int(ints, i));
+        assert(gstack_push_double(doubles, i + 0.5));
+        assert(gstack_push_ptr(ptrs, (void *) &ints));
+    }
+
+    /* The typed and untyped APIs see the same elements. */
+    assert(*(const int *) gstack_peek(ints) == 999);
+    assert(gstack_push(ints, &(int) {1000}));
+    assert(gstack_peek_int(ints) == 1000);
+    assert(gstack_pop_int(ints) == 1000);
+
+    /* The out-of-line functions, in case GSTACK_INLINE made macros of these. */
+    assert((gstack_push_int)(ints, 1000) && !(gstack_push_double)(ints, 1.0));
+    assert((gstack_peek_int)(ints) == 1000 && (gstack_pop_int)(ints) == 1000);
+
+    for (int i = 999; i >= 0; --i) {
+        assert(gstack_pop_int(ints) == i);
+        assert(gstack_pop_double(doubles) == i + 0.5);
+        assert(gstack_pop_ptr(ptrs) == &ints);
+    }
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+    const int answer = 42;
+
+    assert(GSTACK_PUSH(ints, answer));
+    assert(GSTACK_PUSH(ints, 'x'));
+    assert(!GSTACK_PUSH(ints, 1.5));
+    assert(GSTACK_PUSH(doubles, 1.5));
+    assert(GSTACK_PUSH(ptrs, (void *) &answer));
+    assert(GSTACK_PEEK(ints, int) == 'x');
+    assert(GSTACK_POP(ints, int) == 'x');
+    assert(GSTACK_POP(ints, int) == 42);
+    assert(GSTACK_POP(doubles, double) == 1.5);
+    assert(GSTACK_POP(ptrs, void *) == &answer);
+#endif
+
+    gstack_destroy(ints);
+    gstack_destroy(doubles);
+    gstack_destroy(ptrs);
+}
+
+static void test_symtab(void)
+{
+    static char names[1000][8];
+    int values[1000];
+    gstack_symtab *const t = gstack_symtab_create(0);
+    assert(t);
+
+    for (int i = 0; i < 1000; ++i) {
+        snprintf(names[i], sizeof names[i], "v%d", i);
+        values[i] = i;
+    }
+
+    assert(gstack_symtab_bind(t, "x", &values[1]));
+    assert(gstack_symtab_lookup(t, "x") == &values[1]);
+    assert(!gstack_symtab_lookup(t, "y"));
+    assert(!gstack_symtab_leave(t));
+
+    assert(gstack_symtab_enter(t));
+    assert(gstack_symtab_depth(t) == 1);
+    assert(!gstack_symtab_lookup_local(t, "x"));
+    assert(gstack_symtab_bind(t, "x", &values[2]));
+    assert(gstack_symtab_bind(t, "y", &values[3]));
+    assert(gstack_symtab_lookup(t, "x") == &values[2]);
+    assert(gstack_symtab_lookup_local(t, "x") == &values[2]);
+
+    /* Enough names to grow the index, and enough clusters to exercise the
+     * deletions.
+     */
+    assert(gstack_symtab_enter(t));
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(gstack_symtab_bind(t, names[i], &values[i]));
+    }
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(gstack_symtab_lookup(t, names[i]) == &values[i]);
+    }
+
+    assert(gstack_symtab_leave(t));
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(!gstack_symtab_lookup(t, names[i]));
+    }
+
+    assert(gstack_symtab_lookup(t, "y") == &values[3]);
+    assert(gstack_symtab_leave(t));
+    assert(gstack_symtab_depth(t) == 0);
+    assert(gstack_symtab_lookup(t, "x") == &values[1]);
+    assert(!gstack_symtab_lookup(t, "y"));
+    gstack_symtab_destroy(t);
+}
+
+#ifdef GSTACK_SAMPLING
+static void test_sampling(void)
+{
+    gstack *const stack = gstack_create(4, sizeof (int));
+    gstack_sample samples[16];
+    char line[64];
+    assert(stack);
+
+    assert(!gstack_sample_start(stack, 0, 1));
+    assert(gstack_samples(stack, NULL, 0) == 0);
+    assert(gstack_sample_start(stack, 16, 10));
+
+    for (int i = 0; i < 100; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+
+    /* One every 10 operations, and one per doubling from 4 to at least 100. */
+    const size_t n = gstack_samples(stack, samples, 16);
+    assert(n <= 15);
+
+    size_t grows = 0, ops = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        assert(samples[i].size <= samples[i].cap);
+        assert(i == 0 || samples[i].ns >= samples[i - 1].ns);
+        grows += samples[i].event == GSTACK_SAMPLE_GROW;
+        ops += samples[i].event == GSTACK_SAMPLE_OP && samples[i].size % 10 == 0;
+    }
+
+    assert(ops == 10 && grows == n - ops && grows >= 3);
+    assert(samples[n - 1].size == 100);
+
+    while (gstack_pop(stack)) {
+        ;
+    }
+
+    /* The ring keeps the newest samples only. */
+    assert(gstack_samples(stack, NULL, 0) == 16);
+    assert(gstack_samples(stack, samples, 2) == 2);
+    assert(samples[1].size == 0 && samples[1].event == GSTACK_SAMPLE_OP);
+
+    FILE *const csv = tmpfile();
+    assert(csv);
+    assert(gstack_sample_export(stack, csv));
+    rewind(csv);
+    assert(fgets(line, sizeof line, csv) && strcmp(line, "ns,size,cap,event\n") == 0);
+
+    size_t lines = 0;
+
+    while (fgets(line, sizeof line, csv)) {
+        ++lines;
+    }
+
+    assert(lines == 16);
+    fclose(csv);
+
+    gstack_sample_stop(stack);
+    assert(gstack_samples(stack, NULL, 0) == 0);
+    gstack_destroy(stack);
+}
+#endif
+
+#ifdef GSTACK_HISTOGRAMS
+static void test_resize_hists(void)
+{
+    static gstack_resize_hists mine, all;
+    gstack *const stack = gstack_create(4, sizeof (int));
+    assert(stack);
+
+    assert(!gstack_resize_hists_of(stack, &mine));
+    assert(gstack_track_resizes(stack, true));
+    gstack_resize_hists_reset_all();
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+
+    while (gstack_pop(stack)) {
+        ;
+    }
+
+    assert(gstack_resize_hists_of(stack, &mine));
+    gstack_resize_hists_all(&all);
+    assert(mine.grow_ns.count >= 5 && mine.shrink_ns.count >= 5);
+    assert(mine.moved_bytes.count == mine.grow_ns.count + mine.shrink_ns.count);
+    assert(mine.moved_bytes.max <= 1000 * sizeof (int));
+    assert(all.grow_ns.count >= mine.grow_ns.count);
+    assert(gstack_hist_percentile(&mine.grow_ns, 99.9) <= mine.grow_ns.max);
+
+    assert(gstack_track_resizes(stack, false));
+    assert(!gstack_resize_hists_of(stack, &mine));
+    gstack_destroy(stack);
+
+#ifdef GSTACK_BACKENDS
+    /* Neither copies the elements. */
+    const gstack_backend others[] = { GSTACK_SEGMENTED, GSTACK_INDIRECT };
+
+    for (size_t k = 0; k < sizeof others / sizeof *others; ++k) {
+        const gstack_backend b = others[k];
+        gstack *const other = gstack_create_with(4, sizeof (int), b, NULL);
+        assert(other && gstack_track_resizes(other, true));
+
+        for (int i = 0; i < 1000; ++i) {
+            assert(gstack_push(other, &i));
+        }
+
+        assert(gstack_resize_hists_of(other, &mine) && mine.grow_ns.count > 0);
+        assert(mine.moved_bytes.max <= (b == GSTACK_SEGMENTED ? 0 : 1000 * sizeof (char *)));
+        gstack_destroy(other);
+    }
+#endif
+}
+#endif
+
+static void test_prio(void)
+{
+    gstack_prio *p = gstack_prio_create(GSTACK_PRIO_MAX_LEVELS + 1, sizeof (int));
+    unsigned level;
+    int v;
+    assert(!p);
+
+    p = gstack_prio_create(GSTACK_PRIO_MAX_LEVELS, sizeof (int));
+    assert(p);
+    assert(!gstack_prio_pop(p, &v, &level) && !gstack_prio_peek(p, NULL));
+    assert(!gstack_prio_push(p, GSTACK_PRIO_MAX_LEVELS, &v));
+
+    /* Three rounds, so that the nodes freed are reused. */
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 300; ++i) {
+            assert(gstack_prio_push(p, (unsigned) (i * 7) % 64, &i));
+        }
+
+        assert(gstack_prio_size(p) == 300);
+        assert(gstack_prio_level_size(p, 63) == 5);
+        assert(*(const int *) gstack_prio_peek(p, &level) == 265 && level == 63);
+
+        unsigned last = GSTACK_PRIO_MAX_LEVELS;
+        int prev = 0;
+
+        for (int i = 0; i < 300; ++i) {
+            assert(gstack_prio_pop(p, &v, &level));
+            assert(level == (unsigned) (v * 7) % 64);
+            assert(level < last || (level == last && v < prev));
+            last = level;
+            prev = v;
+        }
+
+        assert(gstack_prio_size(p) == 0 && gstack_prio_level_size(p, 0) == 0);
+    }
+
+    assert(gstack_prio_push(p, 0, &v) && gstack_prio_push(p, 1, &v));
+    gstack_prio_destroy(p);
+}
+
+#ifdef GSTACK_TOMBSTONES
+static bool test_is_even(const void *elem, void *ctx)
+{
+    (void) ctx;
+    return *(const int *) elem % 2 == 0;
+}
+
+static bool test_count(const void *elem, void *ctx)
+{
+    (void) elem;
+    ++*(size_t *) ctx;
+    return true;
+}
+
+static void test_tombstones(void)
+{
+    gstack *const stack = gstack_create(16, sizeof (int));
+    size_t count = 0;
+    int v;
+    assert(stack);
+
+    for (int i = 0; i < 200; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+
+    /* The top goes at once, the others stay as tombstones. */
+    assert(gstack_remove_at(stack, 199));
+    assert(gstack_size(stack) == 199 && gstack_tombstones(stack) == 0);
+    assert(gstack_remove_at(stack, 197) && gstack_remove_at(stack, 198));
+    assert(gstack_size(stack) == 197 && *(const int *) gstack_peek(stack) == 196);
+    assert(gstack_remove_at(stack, 100) && gstack_remove_at(stack, 101));
+    assert(!gstack_remove_at(stack, 100) && !gstack_remove_at(stack, 197));
+    assert(gstack_tombstones(stack) == 2 && !gstack_at(stack, 100));
+    assert(gstack_iterate(stack, test_count, &count) && count == 195);
+
+    /* Popping past them. */
+    for (int i = 196; i > 101; --i) {
+        assert(*(const int *) gstack_pop(stack) == i);
+    }
+    assert(gstack_size(stack) == 100 && gstack_tombstones(stack) == 0);
+    assert(*(const int *) gstack_peek(stack) == 99);
+
+    /* Half of them: compacted. */
+    assert(gstack_remove_if(stack, test_is_even, NULL) == 50);
+    assert(gstack_size(stack) == 50 && gstack_tombstones(stack) == 0);
+    for (int i = 0; i < 50; ++i) {
+        assert(*(const int *) gstack_at(stack, (size_t) i) == 2 * i + 1);
+    }
+
+    /* Rewinding drops the tombstones above the mark. */
+    assert(gstack_remove_at(stack, 10) && gstack_remove_at(stack, 30));
+    assert(gstack_rewind(stack, 20) && gstack_tombstones(stack) == 1);
+    assert(gstack_rewind(stack, 11) && gstack_size(stack) == 10);
+    assert(gstack_tombstones(stack) == 0 && *(const int *) gstack_peek(stack) == 19);
+
+    /* A transaction compacts first. */
+    assert(gstack_remove_at(stack, 0) && gstack_tombstones(stack) == 1);
+    assert(gstack_txn_begin(stack));
+    assert(gstack_tombstones(stack) == 0 && *(const int *) gstack_at(stack, 0) == 3);
+    assert(!gstack_remove_at(stack, 0) && gstack_remove_if(stack, test_is_even, NULL) == 0);
+    assert(gstack_pop(stack) && gstack_txn_abort(stack));
+    assert(gstack_size(stack) == 9);
+
+    gstack_compact(stack);
+    while ((gstack_pop(stack))) {
+    }
+    v = 7;
+    assert(gstack_push(stack, &v) && gstack_remove_at(stack, 0) && gstack_is_empty(stack));
+    gstack_destroy(stack);
+}
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+/* Writes the 5000 elements of `out` to a file, then reads them back onto `in`,
+ * and destroys both.
+ */
+static void test_fd_round_trip(gstack *out, gstack *in)
+{
+    char path[64];
+
+    snprintf(path, sizeof path, "/tmp/gstack-fd-%ld", (long) getpid());
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(out && in && fd != -1);
+    unlink(path);
+
+    /* Three bytes of an element too many, which are discarded. */
+    assert(gstack_write_to_fd(out, fd));
+    assert(write(fd, "abc", 3) == 3);
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+
+    assert(gstack_push_from_fd(in, fd, 10) == 10);
+    assert(gstack_txn_begin(in));
+    assert(gstack_push_from_fd(in, fd, 90) == 90);
+    assert(gstack_txn_commit(in));
+    errno = 0;
+    assert(gstack_push_from_fd(in, fd, SIZE_MAX) == 4900 && errno == 0);
+    assert(gstack_push_from_fd(in, fd, SIZE_MAX) == 0);
+    close(fd);
+
+    assert(gstack_size(in) == 5000);
+    for (size_t i = 0; i < 5000; ++i) {
+        assert(*(const int *) gstack_at(in, i) == (int) i);
+    }
+
+    gstack_destroy(out);
+    gstack_destroy(in);
+}
+
+/* Pushes 0 to 4999 onto the stack referenced by `s`, and returns it. */
+static gstack *test_fd_filled(gstack *s)
+{
+    assert(s);
+
+    for (int i = 0; i < 5000; ++i) {
+        assert(gstack_push(s, &i));
+    }
+
+    return s;
+}
+
+static void test_fd_io(void)
+{
+    test_fd_round_trip(test_fd_filled(gstack_create(1, sizeof (int))),
+                       gstack_create(1, sizeof (int)));
+
+#ifdef GSTACK_SAMPLING
+    /* A sampled stack reads through a buffer. */
+    gstack *const sampled = gstack_create(1, sizeof (int));
+    assert(sampled && gstack_sample_start(sampled, 16, 100));
+    test_fd_round_trip(test_fd_filled(gstack_create(1, sizeof (int))), sampled);
+#endif
+
+#ifdef GSTACK_BACKENDS
+    /* And so does one whose elements are not contiguous, which is written out
+     * a segment at a time.
+     */
+    test_fd_round_trip(test_fd_filled(gstack_create_with(1, sizeof (int), GSTACK_SEGMENTED, NULL)),
+                       gstack_create_with(1, sizeof (int), GSTACK_SEGMENTED, NULL));
+
+    /* A stack that cannot grow stops the read with ENOMEM. */
+    gstack *const out = test_fd_filled(gstack_create(1, sizeof (int)));
+    gstack *const in = gstack_create_with(100, sizeof (int), GSTACK_BOUNDED, NULL);
+    char path[64];
+
+    snprintf(path, sizeof path, "/tmp/gstack-fd-%ld", (long) getpid());
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(in && fd != -1);
+    unlink(path);
+
+    assert(gstack_write_to_fd(out, fd));
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    errno = 0;
+    assert(gstack_push_from_fd(in, fd, SIZE_MAX) == 100 && errno == ENOMEM);
+    close(fd);
+
+    gstack_destroy(out);
+    gstack_destroy(in);
+#endif
+}
+#endif
+
+#ifdef GSTACK_BUDGETS
+static bool test_raise_limit(gstack_budget *b, gstack *s, size_t need, void *ctx)
+{
+    gstack_budget_usage usage;
+
+    (void) s;
+    gstack_budget_query(b, &usage);
+    gstack_budget_set_limit(b, usage.used + need);
+    ++*(int *) ctx;
+    return true;
+}
+
+static void test_budgets(void)
+{
+    gstack_budget *const b = gstack_budget_create(4096, NULL, NULL);
+    gstack *const x = gstack_create(16, sizeof (int));
+    gstack *const y = gstack_create(16, sizeof (int));
+    gstack_budget_usage usage;
+    int calls = 0;
+    assert(b && x && y);
+
+    assert(gstack_budget_join(x, b) && gstack_budget_join(y, b));
+    assert(!gstack_budget_join(x, b) && gstack_budget_of(x) == b);
+
+    /* Both grow until the budget runs out. */
+    for (int i = 0; gstack_push(x, &i) && gstack_push(y, &i); ++i) {
+    }
+    gstack_budget_query(b, &usage);
+    assert(usage.stacks == 2 && usage.failures == 1 && usage.limit == 4096);
+    assert(usage.used == (gstack_capacity(x) + gstack_capacity(y)) * sizeof (int));
+    assert(usage.peak == usage.used);
+
+    /* Shrinking gives back. */
+    while (gstack_pop(x)) {
+    }
+    gstack_budget_query(b, &usage);
+    assert(usage.used == (gstack_capacity(x) + gstack_capacity(y)) * sizeof (int));
+    assert(usage.peak > usage.used);
+
+    gstack_destroy(x);
+    gstack_budget_query(b, &usage);
+    assert(usage.stacks == 1 && usage.used == gstack_capacity(y) * sizeof (int));
+    assert(!gstack_budget_destroy(b));
+    gstack_destroy(y);
+    assert(gstack_budget_destroy(b));
+
+    /* A callback that makes room. */
+    gstack_budget *const c = gstack_budget_create(0, test_raise_limit, &calls);
+    gstack *const z = gstack_create(4, sizeof (int));
+    assert(c && z && gstack_budget_join(z, c) && calls == 1);
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(gstack_push(z, &i));
+    }
+    gstack_budget_query(c, &usage);
+    assert(calls > 1 && usage.failures == 0 && usage.used >= usage.limit);
+
+    gstack_destroy(z);
+    assert(gstack_budget_destroy(c));
+
+#ifdef GSTACK_BACKENDS
+    /* What is charged is the memory held, and a shrink of a GSTACK_INDIRECT
+     * stack only gives back its table of blocks.
+     */
+    gstack_budget *const d = gstack_budget_create(SIZE_MAX, NULL, NULL);
+    gstack *const seg = gstack_create_with(4, sizeof (int), GSTACK_SEGMENTED, NULL);
+    gstack *const ind = gstack_create_with(4, 100, GSTACK_INDIRECT, NULL);
+    const char elem[100] = { 0 };
+    assert(d && seg && ind);
+
+    assert(gstack_budget_join(seg, d));
+    gstack_budget_query(d, &usage);
+    assert(usage.used > gstack_capacity(seg) * sizeof (int));
+    gstack_destroy(seg);
+
+    assert(gstack_budget_join(ind, d));
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(gstack_push(ind, elem));
+    }
+    gstack_budget_query(d, &usage);
+    assert(usage.used >= gstack_capacity(ind) * (sizeof elem + sizeof (char *)));
+
+    const size_t grown = usage.used, cap = gstack_capacity(ind);
+
+    while (gstack_pop(ind)) {
+    }
+    gstack_budget_query(d, &usage);
+    assert(grown - usage.used == (cap - gstack_capacity(ind)) * sizeof (char *));
+
+    gstack_destroy(ind);
+    gstack_budget_query(d, &usage);
+    assert(usage.used == 0 && usage.stacks == 0);
+    assert(gstack_budget_destroy(d));
+#endif
+}
+#endif
+
+static void *test_forward(void *p, void *ctx)
+{
+    return (char *) p + *(ptrdiff_t *) ctx;
+}
+
+static void test_roots(void)
+{
+    static int objects[2][100];
+    ptrdiff_t offset = (char *) objects[1] - (char *) objects[0];
+    gstack_roots *const r = gstack_roots_create(0);
+    size_t count;
+    assert(r);
+
+    assert(!gstack_roots_leave(r));
+    assert(gstack_roots_enter(r));
+    assert(gstack_roots_push(r, &objects[0][0]));
+    assert(gstack_roots_push(r, NULL));
+    assert(gstack_roots_enter(r));
+
+    for (int i = 1; i < 100; ++i) {
+        assert(gstack_roots_push(r, &objects[0][i]));
+    }
+
+    assert(gstack_roots_depth(r) == 2);
+    assert(gstack_roots_size(r) == 101);
+    assert(*gstack_roots_at(r, 0) == &objects[0][0]);
+    assert(*gstack_roots_at(r, 100) == &objects[0][99]);
+    assert(!gstack_roots_at(r, 101));
+
+    gstack_roots_update(r, test_forward, &offset);
+    void **const roots = gstack_roots_scan(r, &count);
+    assert(count == 101);
+    assert(roots[0] == &objects[1][0] && !roots[1]);
+
+    for (size_t i = 2; i < count; ++i) {
+        assert(roots[i] == &objects[1][i - 1]);
+    }
+
+    assert(gstack_roots_leave(r));
+    assert(gstack_roots_size(r) == 2);
+    assert(*gstack_roots_at(r, 0) == &objects[1][0]);
+    assert(gstack_roots_leave(r));
+    assert(gstack_roots_size(r) == 0 && gstack_roots_depth(r) == 0);
+    gstack_roots_destroy(r);
+}
+
+static void test_hist(void)
+{
+    static gstack_hist h;
+
+    assert(gstack_hist_percentile(&h, 50) == 0);
+
+    for (uint64_t v = 1; v <= 1000; ++v) {
+        gstack_hist_record(&h, v);
+    }
+
+    assert(h.count == 1000 && h.max == 1000 && h.sum == 500500);
+    assert(gstack_hist_percentile(&h, 100) == 1000);
+
+    const uint64_t median = gstack_hist_percentile(&h, 50);
+    assert(median >= 500 && median <= 500 + 500 / 8);
+
+    gstack_hist_record(&h, UINT64_MAX);
+    assert(gstack_hist_percentile(&h, 100) == UINT64_MAX);
+}
+
+#if defined(GSTACK_HAS_ATOMICS) && !defined(__STDC_NO_THREADS__)
+#include <threads.h>
+
+static int test_sync_worker(void *arg)
+{
+    gstack_sync *const s = arg;
+
+    for (int i = 0; i < 20000; ++i) {
+        int v;
+
+        assert(gstack_sync_push(s, &i));
+        assert(gstack_sync_pop(s, &v));
+    }
+
+    return 0;
+}
+
+static void test_sync(void)
+{
+    gstack_sync *const s = gstack_sync_create(16, sizeof (int));
+    thrd_t threads[4];
+    gstack_lock_stats stats;
+    int v = 42;
+
+    assert(s);
+    assert(!gstack_sync_pop(s, &v) && v == 42);
+    gstack_sync_track(s, true);
+
+    for (int i = 0; i < 4; ++i) {
+        assert(thrd_create(&threads[i], test_sync_worker, s) == thrd_success);
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        assert(thrd_join(threads[i], NULL) == thrd_success);
+    }
+
+    assert(gstack_sync_size(s) == 0);
+    gstack_sync_stats(s, &stats);
+    assert(stats.acquisitions >= 4 * 2 * 20000);
+    assert(stats.contended <= stats.acquisitions && stats.parked <= stats.contended);
+    assert(stats.wait_ns.count == stats.acquisitions);
+    assert(stats.hold_ns.count + 1 == stats.acquisitions);
+
+    gstack_sync_track(s, false);
+    assert(gstack_sync_push(s, &v));
+    assert(gstack_sync_peek(s, &v) && v == 42);
+    gstack_sync_stats(s, &stats);
+    assert(stats.wait_ns.count == stats.acquisitions);
+    gstack_sync_destroy(s);
+}
+#endif
+
+#ifdef GSTACK_DURABLE
+static void test_durable(void)
+{
+    char path[64], snap[sizeof path + 5];
+    const gstack_durable_opts opts = { 4, 0, 0, 0 };
+    gstack_durable *d;
+    uint64_t seq;
+    int v;
+
+    snprintf(path, sizeof path, "/tmp/gstack-durable-%ld", (long) getpid());
+    snprintf(snap, sizeof snap, "%s.snap", path);
+    (void) remove(path);
+    (void) remove(snap);
+
+    /* A group is committed every 4 records. */
+    d = gstack_durable_open(path, sizeof (int), &opts);
+    assert(d);
+    for (int i = 0; i < 10; ++i) {
+        assert(gstack_durable_push(d, &i, &seq));
+        assert(seq == (uint64_t) i + 1);
+    }
+    assert(gstack_durable_committed(d) == 8);
+    assert(gstack_durable_wait(d, 10) && gstack_durable_committed(d) == 10);
+    assert(gstack_durable_pop(d, &v, &seq) && v == 9 && seq == 11);
+    assert(gstack_durable_close(d));
+
+    /* The log alone. */
+    d = gstack_durable_open(path, sizeof (int), &opts);
+    assert(d && gstack_durable_size(d) == 9);
+    assert(*(const int *) gstack_durable_peek(d) == 8);
+    assert(gstack_durable_committed(d) == 11);
+
+    /* The snapshot then the log. */
+    assert(gstack_durable_compact(d));
+    assert(gstack_durable_pop(d, &v, NULL) && v == 8);
+    assert(gstack_durable_close(d));
+    assert(!gstack_durable_open(path, sizeof (long long), &opts));
+
+    /* A torn record at the end is dropped. */
+    FILE *const log = fopen(path, "ab");
+    assert(log && fwrite("garbage", 1, 7, log) == 7 && fclose(log) == 0);
+
+    d = gstack_durable_open(path, sizeof (int), &opts);
+    assert(d && gstack_durable_size(d) == 8);
+    assert(gstack_durable_committed(d) == 12);
+    while (gstack_durable_pop(d, &v, NULL)) {
+    }
+    assert(gstack_durable_push(d, &v, &seq) && seq == 21);
+    assert(gstack_durable_close(d));
+
+    d = gstack_durable_open(path, sizeof (int), &opts);
+    assert(d && gstack_durable_size(d) == 1 && gstack_durable_committed(d) == 21);
+    assert(gstack_durable_close(d));
+
+    assert(remove(path) == 0 && remove(snap) == 0);
+}
+#endif
+
+int main(void)
+{
+    gstack *stack = gstack_create(SIZE_MAX - 1000, sizeof (size_t));
+    assert(!stack);
+    
+    stack = gstack_create(10000, sizeof (size_t));
+    assert(stack);
+    assert(!gstack_is_full(stack));
+
+    for (size_t i = 0; i < 200000; ++i) {
+        assert(gstack_push(stack, &i));
+    }
+    
+    assert(!gstack_is_empty(stack));
+    assert(gstack_size(stack) == 200000);
+    assert(*(size_t *) gstack_peek(stack) == 199999);
+
+    /* The out-of-line functions, in case GSTACK_INLINE made macros of these. */
+    assert(!(gstack_is_empty)(stack));
+    assert((gstack_size)(stack) == 200000);
+    assert((gstack_peek)(stack) == gstack_peek(stack));
+
+    for (size_t i = 199999; i < SIZE_MAX; i--) {
+        assert(*(size_t *) gstack_peek(stack) == i);
+        assert(*(size_t *) gstack_pop(stack) == i);
+    }
+
+    assert(gstack_is_empty(stack));
+    assert(gstack_size(stack) == 0);
+    gstack_destroy(stack);
+
+    test_mark_rewind();
+    test_txn();
+    test_trim();
+#ifdef GSTACK_REGISTRY
+    test_metrics();
+#endif
+    test_large();
+    test_backends();
+    test_typed();
+    test_symtab();
+    test_roots();
+    test_prio();
+#ifdef GSTACK_BUDGETS
+    test_budgets();
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+    test_fd_io();
+#endif
+#ifdef GSTACK_TOMBSTONES
+    test_tombstones();
+#endif
+#ifdef GSTACK_DURABLE
+    test_durable();
+#endif
+    test_hist();
+#ifdef GSTACK_SAMPLING
+    test_sampling();
+#endif
+#ifdef GSTACK_HISTOGRAMS
+    test_resize_hists();
+#endif
+#if defined(GSTACK_HAS_ATOMICS) && !defined(__STDC_NO_THREADS__)
+    test_sync();
+#endif
+    return EXIT_SUCCESS;
+}
 
 #endif                          /* TEST_MAIN */
+
+#ifdef BENCH_MAIN
+
+#include <time.h>
+
+#if defined(__linux__) && (defined(_GNU_SOURCE) || defined(_DEFAULT_SOURCE))
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+
+    #ifdef SYS_perf_event_open
+        #define BENCH_HAS_PERF
+    #endif
+#endif
+
+/* Runs the same workloads through every backend and reports the time taken per
+ * operation and the peak memory held by the stack.
+ *
+ * With --counters, it also reports the hardware and software counters of
+ * every workload per operation, where perf_event_open() lets it read them.
+ *
+ * Then it runs a kit of graph and parsing algorithms over generated inputs
+ * through every backend: an iterative DFS, Tarjan's strongly connected
+ * components and a topological sort over graphs in CSR form, bracket matching,
+ * and shunting-yard evaluation.
+ *
+ * Usage: ./bench [count] [--counters]
+ */
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static bool bench_sum(const void *elem, void *ctx)
+{
+    *(size_t *) ctx += *(const size_t *) elem;
+    return true;
+}
+
+enum { BENCH_PUSH, BENCH_ITERATE, BENCH_POP, BENCH_SAWTOOTH, BENCH_WORKLOADS };
+
+#define BENCH_EVENTS    6
+
+static const char *const bench_workload_names[BENCH_WORKLOADS] = {
+    "push", "iterate", "pop", "sawtooth"
+};
+
+static const char *const bench_event_names[BENCH_EVENTS] = {
+    "cycles", "instr", "L1d-miss", "LLC-miss", "br-miss", "faults"
+};
+
+/* The counter of every event, or -1 if it is unavailable or not wanted. */
+static int bench_fds[BENCH_EVENTS] = { -1, -1, -1, -1, -1, -1 };
+
+typedef struct bench_result {
+    double push_ns;
+    double pop_ns;
+    double iterate_ns;
+    double sawtooth_ns;
+    size_t peak_bytes;
+    double counters[BENCH_WORKLOADS][BENCH_EVENTS];    /* Per operation. */
+} bench_result;
+
+/* Opens every counter it can, and returns how many. */
+static int bench_counters_open(void)
+{
+    int opened = 0;
+
+#ifdef BENCH_HAS_PERF
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[BENCH_EVENTS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                              | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+    };
+
+    for (int i = 0; i < BENCH_EVENTS; ++i) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_hv = 1;
+
+        /* Most systems only let unprivileged users count their own code. */
+        attr.exclude_kernel = events[i].type != PERF_TYPE_SOFTWARE;
+
+        bench_fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        opened += bench_fds[i] >= 0;
+    }
+#endif
+
+    return opened;
+}
+
+static void bench_counters_start(void)
+{
+#ifdef BENCH_HAS_PERF
+    for (int i = 0; i < BENCH_EVENTS; ++i) {
+        if (bench_fds[i] >= 0) {
+            ioctl(bench_fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(bench_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/* Stores the counts since bench_counters_start() per operation in `out`, or -1
+ * for the unavailable ones.
+ */
+static void bench_counters_stop(double out[BENCH_EVENTS], size_t ops)
+{
+    for (int i = 0; i < BENCH_EVENTS; ++i) {
+        out[i] = -1;
+
+        if (bench_fds[i] < 0) {
+            continue;
+        }
+
+#ifdef BENCH_HAS_PERF
+        uint64_t value;
+
+        ioctl(bench_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        if (read(bench_fds[i], &value, sizeof value) == (ssize_t) sizeof value) {
+            out[i] = (double) value / (double) ops;
+        }
+#else
+        (void) ops;
+#endif
+    }
+}
+
+static void bench_counters_close(void)
+{
+#ifdef BENCH_HAS_PERF
+    for (int i = 0; i < BENCH_EVENTS; ++i) {
+        if (bench_fds[i] >= 0) {
+            close(bench_fds[i]);
+        }
+    }
+#endif
+}
+
+static bool bench_run(gstack *s, size_t count, bench_result *r)
+{
+    volatile size_t sink = 0;
+
+    if (!s) {
+        return false;
+    }
+
+    /* Fill and drain. */
+    bench_counters_start();
+    double start = bench_now();
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!gstack_push(s, &i)) {
+            gstack_destroy(s);
+            return false;
+        }
+    }
+
+    r->push_ns = (bench_now() - start) / (double) count;
+    bench_counters_stop(r->counters[BENCH_PUSH], count);
+    /* What the backend holds, e.g. the segment table or the slabs too. */
+    r->peak_bytes = gstack_footprint(s);
+
+    size_t sum = 0;
+
+    bench_counters_start();
+    start = bench_now();
+    gstack_iterate(s, bench_sum, &sum);
+    r->iterate_ns = (bench_now() - start) / (double) count;
+    bench_counters_stop(r->counters[BENCH_ITERATE], count);
+    sink += sum;
+
+    bench_counters_start();
+    start = bench_now();
+
+    for (size_t i = 0; i < count; ++i) {
+        sink += *(size_t *) gstack_pop(s);
+    }
+
+    r->pop_ns = (bench_now() - start) / (double) count;
+    bench_counters_stop(r->counters[BENCH_POP], count);
+
+    /* Shallow pushes and pops around the same depth, as in a DFS. */
+    bench_counters_start();
+    start = bench_now();
+
+    for (size_t i = 0; i < count / 64; ++i) {
+        for (size_t j = 0; j < 64; ++j) {
+            if (!gstack_push(s, &j)) {
+                gstack_destroy(s);
+                return false;
+            }
+        }
+        for (size_t j = 0; j < 64; ++j) {
+            sink += *(size_t *) gstack_pop(s);
+        }
+    }
+
+    r->sawtooth_ns = (bench_now() - start) / (double) (count / 64 * 128);
+    bench_counters_stop(r->counters[BENCH_SAWTOOTH], count / 64 * 128);
+    (void) sink;
+    gstack_destroy(s);
+    return true;
+}
+
+static void bench_report(const char *name, const bench_result *r, bool counters)
+{
+    printf("%-12s %10.2f %10.2f %10.2f %10.2f %12zu\n", name, r->push_ns, r->pop_ns,
+           r->iterate_ns, r->sawtooth_ns, r->peak_bytes / 1024);
+
+    for (int w = 0; counters && w < BENCH_WORKLOADS; ++w) {
+        printf("  %-10s", bench_workload_names[w]);
+
+        for (int i = 0; i < BENCH_EVENTS; ++i) {
+            if (r->counters[w][i] < 0) {
+                printf(" %10s", "-");
+            } else {
+                printf(" %10.3f", r->counters[w][i]);
+            }
+        }
+
+        putchar('\n');
+    }
+}
+
+/* The graph and parsing workload kit: the algorithms gstack is mostly used for,
+ * over generated inputs, so that a change is measured against the access
+ * patterns of real traversals rather than a fill and drain. Every result is
+ * checked, outside the timed part.
+ */
+static uint64_t bench_rng = 88172645463325252u;
+
+static uint64_t bench_rand(void)
+{
+    /* xorshift64. */
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 7;
+    bench_rng ^= bench_rng << 17;
+    return bench_rng;
+}
+
+/* In compressed sparse row form: the edges of v are the targets from
+ * offsets[v] to offsets[v + 1].
+ */
+typedef struct bench_graph {
+    size_t n;
+    size_t m;
+    size_t *offsets;
+    uint32_t *targets;
+} bench_graph;
+
+/* Makes a graph of `n` vertices of random out-degrees averaging `degree`, with
+ * edges only to higher vertices if `dag`.
+ */
+static bool bench_graph_make(bench_graph *g, size_t n, size_t degree, bool dag)
+{
+    g->n = n;
+    g->offsets = malloc((n + 1) * sizeof *g->offsets);
+    g->targets = NULL;
+
+    if (!g->offsets) {
+        return false;
+    }
+
+    g->offsets[0] = 0;
+
+    for (size_t v = 0; v < n; ++v) {
+        size_t d = (size_t) (bench_rand() % (2 * degree + 1));
+
+        if (dag && d > n - 1 - v) {
+            d = n - 1 - v;
+        }
+
+        g->offsets[v + 1] = g->offsets[v] + d;
+    }
+
+    g->m = g->offsets[n];
+
+    if (!(g->targets = malloc((g->m ? g->m : 1) * sizeof *g->targets))) {
+        free(g->offsets);
+        return false;
+    }
+
+    for (size_t v = 0; v < n; ++v) {
+        for (size_t e = g->offsets[v]; e < g->offsets[v + 1]; ++e) {
+            g->targets[e] = (uint32_t) (dag ? v + 1 + bench_rand() % (n - 1 - v) : bench_rand() % n);
+        }
+    }
+
+    return true;
+}
+
+static void bench_graph_free(bench_graph *g)
+{
+    free(g->offsets);
+    free(g->targets);
+}
+
+/* A vertex being explored, and the next of its edges to follow. */
+typedef struct bench_frame {
+    uint32_t v;
+    size_t e;
+} bench_frame;
+
+#define BENCH_NONE      UINT32_MAX
+
+static bench_frame *bench_top(gstack *s)
+{
+    return gstack_at(s, gstack_size(s) - 1);
+}
+
+/* Visits the whole graph depth-first, and returns the count of vertices
+ * visited, or 0 on failure.
+ */
+static size_t bench_dfs(const bench_graph *g, gstack *s, unsigned char *seen)
+{
+    size_t visited = 0;
+
+    memset(seen, 0, g->n);
+
+    for (size_t root = 0; root < g->n; ++root) {
+        if (seen[root]) {
+            continue;
+        }
+
+        bench_frame f = { (uint32_t) root, g->offsets[root] };
+
+        seen[root] = 1;
+        ++visited;
+
+        if (!gstack_push(s, &f)) {
+            return 0;
+        }
+
+        while (!gstack_is_empty(s)) {
+            bench_frame *const top = bench_top(s);
+
+            if (top->e == g->offsets[top->v + 1]) {
+                (void) gstack_pop(s);
+                continue;
+            }
+
+            const uint32_t w = g->targets[top->e++];
+
+            if (!seen[w]) {
+                f.v = w;
+                f.e = g->offsets[w];
+                seen[w] = 1;
+                ++visited;
+
+                if (!gstack_push(s, &f)) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return visited;
+}
+
+/* Tarjan's algorithm, with the recursion on `calls`. Returns the count of
+ * strongly connected components, or 0 on failure.
+ */
+static size_t bench_scc(const bench_graph *g, gstack *calls, gstack *comp, uint32_t *index,
+                        uint32_t *low, unsigned char *on)
+{
+    uint32_t next = 0;
+    size_t sccs = 0;
+
+    for (size_t v = 0; v < g->n; ++v) {
+        index[v] = BENCH_NONE;
+        on[v] = 0;
+    }
+
+    for (size_t root = 0; root < g->n; ++root) {
+        uint32_t v = (uint32_t) root;
+
+        if (index[v] != BENCH_NONE) {
+            continue;
+        }
+
+        for (;;) {
+            /* Enter v. */
+            bench_frame f = { v, g->offsets[v] };
+
+            index[v] = low[v] = next++;
+            on[v] = 1;
+
+            if (!gstack_push(comp, &v) || !gstack_push(calls, &f)) {
+                return 0;
+            }
+
+            /* Follow the edges until one leads to a new vertex. */
+            v = BENCH_NONE;
+
+            while (v == BENCH_NONE && !gstack_is_empty(calls)) {
+                bench_frame *const top = bench_top(calls);
+                const uint32_t u = top->v;
+
+                if (top->e < g->offsets[u + 1]) {
+                    const uint32_t w = g->targets[top->e++];
+
+                    if (index[w] == BENCH_NONE) {
+                        v = w;
+                    } else if (on[w] && index[w] < low[u]) {
+                        low[u] = index[w];
+                    }
+                    continue;
+                }
+
+                (void) gstack_pop(calls);
+
+                if (low[u] == index[u]) {
+                    uint32_t w;
+
+                    do {
+                        w = *(const uint32_t *) gstack_pop(comp);
+                        on[w] = 0;
+                    } while (w != u);
+
+                    ++sccs;
+                }
+
+                if (!gstack_is_empty(calls)) {
+                    bench_frame *const parent = bench_top(calls);
+
+                    if (low[u] < low[parent->v]) {
+                        low[parent->v] = low[u];
+                    }
+                }
+            }
+
+            if (v == BENCH_NONE) {
+                break;
+            }
+        }
+    }
+
+    return sccs;
+}
+
+/* Stores a topological order of the DAG `g` in `order`, from the reverse
+ * postorder of a DFS. Returns false on failure.
+ */
+static bool bench_topo(const bench_graph *g, gstack *s, unsigned char *seen, uint32_t *order)
+{
+    size_t pos = g->n;
+
+    memset(seen, 0, g->n);
+
+    for (size_t root = 0; root < g->n; ++root) {
+        if (seen[root]) {
+            continue;
+        }
+
+        bench_frame f = { (uint32_t) root, g->offsets[root] };
+
+        seen[root] = 1;
+
+        if (!gstack_push(s, &f)) {
+            return false;
+        }
+
+        while (!gstack_is_empty(s)) {
+            bench_frame *const top = bench_top(s);
+
+            if (top->e == g->offsets[top->v + 1]) {
+                order[--pos] = top->v;
+                (void) gstack_pop(s);
+                continue;
+            }
+
+            const uint32_t w = g->targets[top->e++];
+
+            if (!seen[w]) {
+                f.v = w;
+                f.e = g->offsets[w];
+                seen[w] = 1;
+
+                if (!gstack_push(s, &f)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return pos == 0;
+}
+
+static bool bench_topo_valid(const bench_graph *g, const uint32_t *order, uint32_t *rank)
+{
+    for (size_t i = 0; i < g->n; ++i) {
+        rank[order[i]] = (uint32_t) i;
+    }
+
+    for (size_t v = 0; v < g->n; ++v) {
+        for (size_t e = g->offsets[v]; e < g->offsets[v + 1]; ++e) {
+            if (rank[v] >= rank[g->targets[e]]) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/* Makes a balanced sequence of `len` brackets of three kinds, `len` even. */
+static char *bench_parens_make(size_t len)
+{
+    static const char open[] = "([{", close[] = ")]}";
+    char *const text = malloc(len + 1);
+    char *const pending = malloc(len / 2 + 1);
+    size_t depth = 0;
+
+    if (!text || !pending) {
+        free(text);
+        free(pending);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        if (depth == 0 || (depth < len - i && bench_rand() % 2)) {
+            const int k = (int) (bench_rand() % 3);
+
+            text[i] = open[k];
+            pending[depth++] = close[k];
+        } else {
+            text[i] = pending[--depth];
+        }
+    }
+
+    text[len] = '\0';
+    free(pending);
+    return text;
+}
+
+/* Returns whether the brackets of `text` match. */
+static bool bench_parens_match(const char *text, gstack *s)
+{
+    for (const char *c = text; *c; ++c) {
+        switch (*c) {
+        case '(':
+        case '[':
+        case '{':
+            if (!gstack_push_char(s, *c)) {
+                return false;
+            }
+            break;
+        default:
+            if (gstack_is_empty(s)) {
+                return false;
+            }
+
+            const char o = gstack_pop_char(s);
+
+            if ((*c == ')' && o != '(') || (*c == ']' && o != '[') || (*c == '}' && o != '{')) {
+                return false;
+            }
+        }
+    }
+
+    return gstack_is_empty(s);
+}
+
+/* A number, or one of + - * ( ). */
+typedef struct bench_token {
+    char kind;
+    uint64_t value;
+} bench_token;
+
+#define BENCH_EXPR_DEPTH    24
+
+/* Appends an expression to `t`, nesting at most BENCH_EXPR_DEPTH - `depth`
+ * deeper, and only numbers once `cap` is near.
+ */
+static void bench_expr_make(bench_token *t, size_t *len, size_t cap, int depth)
+{
+    static const char ops[] = "+-*";
+    const int terms = 1 + (int) (bench_rand() % 4);
+
+    for (int i = 0; i < terms; ++i) {
+        if (i > 0) {
+            t[(*len)++] = (bench_token) { ops[bench_rand() % 3], 0 };
+        }
+
+        if (depth < BENCH_EXPR_DEPTH && *len + 256 < cap && bench_rand() % 4 == 0) {
+            t[(*len)++] = (bench_token) { '(', 0 };
+            bench_expr_make(t, len, cap, depth + 1);
+            t[(*len)++] = (bench_token) { ')', 0 };
+        } else {
+            t[(*len)++] = (bench_token) { 'n', bench_rand() % 1000 };
+        }
+    }
+}
+
+static uint64_t bench_apply(char op, uint64_t a, uint64_t b)
+{
+    return op == '+' ? a + b : op == '-' ? a - b : a * b;
+}
+
+static int bench_prec(char op)
+{
+    return op == '*' ? 2 : op == '(' ? 0 : 1;
+}
+
+/* Pops an operator and two values, and pushes the result. */
+static bool bench_reduce(gstack *ops, gstack *vals)
+{
+    const char op = gstack_pop_char(ops);
+    const uint64_t *p = gstack_pop(vals);
+
+    if (!p) {
+        return false;
+    }
+
+    /* Copied before the next pop, which may shrink the stack. */
+    const uint64_t rhs = *p;
+
+    if (!(p = gstack_pop(vals))) {
+        return false;
+    }
+
+    const uint64_t r = bench_apply(op, *p, rhs);
+
+    return gstack_push(vals, &r);
+}
+
+/* Evaluates the `n` tokens of `t` with Dijkstra's shunting-yard algorithm. */
+static bool bench_shunt(const bench_token *t, size_t n, gstack *ops, gstack *vals,
+                        uint64_t *out)
+{
+    for (size_t i = 0; i < n; ++i) {
+        switch (t[i].kind) {
+        case 'n':
+            if (!gstack_push(vals, &t[i].value)) {
+                return false;
+            }
+            break;
+        case '(':
+            if (!gstack_push_char(ops, '(')) {
+                return false;
+            }
+            break;
+        case ')':
+            while (!gstack_is_empty(ops) && gstack_peek_char(ops) != '(') {
+                if (!bench_reduce(ops, vals)) {
+                    return false;
+                }
+            }
+            if (!gstack_pop(ops)) {
+                return false;
+            }
+            break;
+        default:
+            while (!gstack_is_empty(ops) && bench_prec(gstack_peek_char(ops)) >= bench_prec(t[i].kind)) {
+                if (!bench_reduce(ops, vals)) {
+                    return false;
+                }
+            }
+            if (!gstack_push_char(ops, t[i].kind)) {
+                return false;
+            }
+        }
+    }
+
+    while (!gstack_is_empty(ops)) {
+        if (!bench_reduce(ops, vals)) {
+            return false;
+        }
+    }
+
+    const uint64_t *const result = gstack_pop(vals);
+
+    if (!result) {
+        return false;
+    }
+
+    *out = *result;
+    return gstack_is_empty(vals);
+}
+
+/* The reference: recursive descent, which BENCH_EXPR_DEPTH keeps shallow. */
+static uint64_t bench_eval_expr(const bench_token *t, size_t *i);
+
+static uint64_t bench_eval_factor(const bench_token *t, size_t *i)
+{
+    if (t[*i].kind == '(') {
+        ++*i;
+
+        const uint64_t v = bench_eval_expr(t, i);
+
+        ++*i;
+        return v;
+    }
+
+    return t[(*i)++].value;
+}
+
+static uint64_t bench_eval_term(const bench_token *t, size_t *i, size_t n)
+{
+    uint64_t v = bench_eval_factor(t, i);
+
+    while (*i < n && t[*i].kind == '*') {
+        ++*i;
+        v *= bench_eval_factor(t, i);
+    }
+
+    return v;
+}
+
+static size_t bench_token_count;
+
+static uint64_t bench_eval_expr(const bench_token *t, size_t *i)
+{
+    uint64_t v = bench_eval_term(t, i, bench_token_count);
+
+    while (*i < bench_token_count && (t[*i].kind == '+' || t[*i].kind == '-')) {
+        const char op = t[(*i)++].kind;
+
+        v = bench_apply(op, v, bench_eval_term(t, i, bench_token_count));
+    }
+
+    return v;
+}
+
+typedef struct bench_kit {
+    bench_graph graph;
+    bench_graph dag;
+    char *parens;
+    size_t parens_len;
+    bench_token *tokens;
+    size_t token_count;
+    uint64_t expect;
+    size_t sccs;                /* Of `graph`, from the first run. */
+
+    unsigned char *seen;
+    uint32_t *index;
+    uint32_t *low;
+    uint32_t *order;
+} bench_kit;
+
+static void bench_kit_free(bench_kit *k)
+{
+    bench_graph_free(&k->graph);
+    bench_graph_free(&k->dag);
+    free(k->parens);
+    free(k->tokens);
+    free(k->seen);
+    free(k->index);
+    free(k->low);
+    free(k->order);
+}
+
+#define BENCH_KIT_MIN   4096
+
+/* Makes inputs of about `count` edges, brackets, and tokens, or of
+ * BENCH_KIT_MIN if `count` is smaller.
+ */
+static bool bench_kit_make(bench_kit *k, size_t count)
+{
+    /* Below this, the graphs would be trivial and no expression would fit. */
+    if (count < BENCH_KIT_MIN) {
+        count = BENCH_KIT_MIN;
+    }
+
+    const size_t n = count / 8 < UINT32_MAX ? count / 8 : UINT32_MAX - 1;
+
+    memset(k, 0, sizeof *k);
+
+    if (!bench_graph_make(&k->graph, n, 8, false)) {
+        return false;
+    }
+
+    if (!bench_graph_make(&k->dag, n, 8, true)) {
+        free(k->graph.offsets);
+        free(k->graph.targets);
+        return false;
+    }
+
+    k->parens_len = count & ~(size_t) 1;
+    k->parens = bench_parens_make(k->parens_len);
+    k->tokens = malloc(count * sizeof *k->tokens);
+    k->seen = malloc(n);
+    k->index = malloc(n * sizeof *k->index);
+    k->low = malloc(n * sizeof *k->low);
+    k->order = malloc(n * sizeof *k->order);
+
+    if (!k->parens || !k->tokens || !k->seen || !k->index || !k->low || !k->order) {
+        bench_kit_free(k);
+        return false;
+    }
+
+    while (k->token_count + 512 < count) {
+        if (k->token_count > 0) {
+            k->tokens[k->token_count++] = (bench_token) { '+', 0 };
+        }
+        bench_expr_make(k->tokens, &k->token_count, count, 0);
+    }
+
+    size_t i = 0;
+
+    bench_token_count = k->token_count;
+    k->expect = bench_eval_expr(k->tokens, &i);
+    return true;
+}
+
+/* A stack for the backend being measured, which can hold `bound` elements if
+ * it has to be bounded.
+ */
+static gstack *bench_stack(int backend, size_t memb_size, size_t bound)
+{
+#ifdef GSTACK_BACKENDS
+    return gstack_create_with(backend == GSTACK_BOUNDED ? bound + 1 : 16, memb_size,
+                              (gstack_backend) backend, NULL);
+#else
+    (void) backend;
+    (void) bound;
+    return gstack_create(16, memb_size);
+#endif
+}
+
+enum { BENCH_DFS, BENCH_SCC, BENCH_TOPO, BENCH_PARENS, BENCH_SHUNT, BENCH_KIT_WORKLOADS };
+
+static const char *const bench_kit_names[BENCH_KIT_WORKLOADS] = {
+    "dfs", "scc", "topo", "parens", "shunt"
+};
+
+/* Runs the kit with the stacks of `backend`, and stores the time per edge,
+ * bracket, or token of every workload in `ns`, or -1 where its result was
+ * wrong. Returns false, and runs nothing, if the stacks cannot be created.
+ */
+static bool bench_kit_run(bench_kit *k, int backend, double ns[BENCH_KIT_WORKLOADS])
+{
+    const bench_graph *const g = &k->graph;
+    gstack *const a = bench_stack(backend, sizeof (bench_frame), g->n);
+    gstack *const b = bench_stack(backend, sizeof (uint32_t), g->n);
+    gstack *const c = bench_stack(backend, sizeof (char), k->parens_len + k->token_count);
+    gstack *const d = bench_stack(backend, sizeof (uint64_t), k->token_count);
+    double start;
+    uint64_t value;
+    bool ok = a && b && c && d;
+
+    if (!ok) {
+        goto out;
+    }
+
+    start = bench_now();
+    ok = bench_dfs(g, a, k->seen) == g->n;
+    ns[BENCH_DFS] = ok ? (bench_now() - start) / (double) (g->n + g->m) : -1;
+
+    start = bench_now();
+    const size_t sccs = bench_scc(g, a, b, k->index, k->low, k->seen);
+    ns[BENCH_SCC] = (bench_now() - start) / (double) (g->n + g->m);
+
+    if (sccs == 0 || (k->sccs && sccs != k->sccs)
+        || bench_scc(&k->dag, a, b, k->index, k->low, k->seen) != k->dag.n) {
+        ns[BENCH_SCC] = -1;
+    }
+    k->sccs = sccs;
+
+    start = bench_now();
+    ok = bench_topo(&k->dag, a, k->seen, k->order);
+    ns[BENCH_TOPO] = (bench_now() - start) / (double) (k->dag.n + k->dag.m);
+
+    if (!ok || !bench_topo_valid(&k->dag, k->order, k->index)) {
+        ns[BENCH_TOPO] = -1;
+    }
+
+    start = bench_now();
+    ok = bench_parens_match(k->parens, c);
+    ns[BENCH_PARENS] = ok ? (bench_now() - start) / (double) k->parens_len : -1;
+
+    start = bench_now();
+    ok = bench_shunt(k->tokens, k->token_count, c, d, &value);
+    ns[BENCH_SHUNT] = ok && value == k->expect ? (bench_now() - start) / (double) k->token_count : -1;
+    ok = true;
+
+out:
+    if (a) {
+        gstack_destroy(a);
+    }
+    if (b) {
+        gstack_destroy(b);
+    }
+    if (c) {
+        gstack_destroy(c);
+    }
+    if (d) {
+        gstack_destroy(d);
+    }
+
+    return ok;
+}
+
+static void bench_kit_report(const char *name, const double ns[BENCH_KIT_WORKLOADS])
+{
+    printf("%-12s", name);
+
+    for (int w = 0; w < BENCH_KIT_WORKLOADS; ++w) {
+        if (ns[w] < 0) {
+            printf(" %10s", "FAILED");
+        } else {
+            printf(" %10.2f", ns[w]);
+        }
+    }
+
+    putchar('\n');
+}
+
+static void bench_kits(size_t count)
+{
+    double ns[BENCH_KIT_WORKLOADS];
+    bench_kit k;
+
+    if (!bench_kit_make(&k, count)) {
+        fputs("Not enough memory for the workload kit.\n", stderr);
+        return;
+    }
+
+    printf("\n%zu vertices, %zu edges, %zu brackets, %zu tokens, ns/edge or ns/symbol\n",
+           k.graph.n, k.graph.m, k.parens_len, k.token_count);
+    printf("%-12s", "backend");
+
+    for (int w = 0; w < BENCH_KIT_WORKLOADS; ++w) {
+        printf(" %10s", bench_kit_names[w]);
+    }
+
+    putchar('\n');
+
+#ifdef GSTACK_BACKENDS
+    for (gstack_backend b = 0; b < GSTACK_BACKEND_COUNT; ++b) {
+        if (bench_kit_run(&k, (int) b, ns)) {
+            bench_kit_report(gstack_backend_name(b), ns);
+        } else {
+            printf("%-12s unavailable\n", gstack_backend_name(b));
+        }
+    }
+#else
+    if (bench_kit_run(&k, 0, ns)) {
+        bench_kit_report("contiguous", ns);
+    }
+#endif
+
+    bench_kit_free(&k);
+}
+
+static void *bench_forward(void *p, void *ctx)
+{
+    (void) ctx;
+    return (char *) p + sizeof (void *);
+}
+
+#ifdef GSTACK_INLINE
+/* Times the sawtooth workload through the inline fast paths, and through calls
+ * to the out-of-line functions that the compiler can not see into, as from
+ * another translation unit without LTO.
+ */
+static void bench_inline(size_t count)
+{
+    bool (*volatile push)(gstack *, const void *) = (gstack_push);
+    void *(*volatile pop)(gstack *) = (gstack_pop);
+    gstack *const s = gstack_create(64, sizeof (size_t));
+    volatile size_t sink = 0;
+    double ns[2];
+
+    if (!s) {
+        return;
+    }
+
+    for (int opaque = 0; opaque < 2; ++opaque) {
+        bool (*const push_fn)(gstack *, const void *) = push;
+        void *(*const pop_fn)(gstack *) = pop;
+        const double start = bench_now();
+
+        for (size_t i = 0; i < count / 64; ++i) {
+            for (size_t j = 0; j < 64; ++j) {
+                if (!(opaque ? push_fn(s, &j) : gstack_push(s, &j))) {
+                    gstack_destroy(s);
+                    return;
+                }
+            }
+            for (size_t j = 0; j < 64; ++j) {
+                sink += *(size_t *) (opaque ? pop_fn(s) : gstack_pop(s));
+            }
+        }
+
+        ns[opaque] = (bench_now() - start) / (double) (count / 64 * 128);
+    }
+
+    (void) sink;
+    printf("\nsawtooth with GSTACK_INLINE, ns/op\n");
+    printf("%-12s %10.2f\n%-12s %10.2f\n", "inline", ns[0], "call", ns[1]);
+    gstack_destroy(s);
+}
+#endif                          /* GSTACK_INLINE */
+
+/* Pushes `count` roots in frames of 8, as a mutator deep in calls would hold
+ * them, then times a marking scan and a forwarding update over all of them.
+ */
+static void bench_roots(size_t count)
+{
+    static char heap[4096];
+    gstack_roots *const r = gstack_roots_create(16);
+    volatile size_t sink = 0;
+
+    if (!r) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if ((i % 8 == 0 && !gstack_roots_enter(r))
+            || !gstack_roots_push(r, i % 5 ? &heap[i % sizeof heap] : NULL)) {
+            gstack_roots_destroy(r);
+            return;
+        }
+    }
+
+    size_t n, live = 0;
+    double start = bench_now();
+    void **const roots = gstack_roots_scan(r, &n);
+
+    for (size_t i = 0; i < n; ++i) {
+        live += roots[i] != NULL;
+    }
+
+    const double scan_ns = (bench_now() - start) / (double) n;
+
+    sink += live;
+    start = bench_now();
+    gstack_roots_update(r, bench_forward, NULL);
+
+    const double update_ns = (bench_now() - start) / (double) n;
+
+    (void) sink;
+    printf("\n%zu roots in %zu frames, ns/root\n", n, gstack_roots_depth(r));
+    printf("%-12s %10.3f\n%-12s %10.3f\n", "scan", scan_ns, "update", update_ns);
+    gstack_roots_destroy(r);
+}
+
+/* A scheduler's mix: push a task at a random level, pop the most urgent. */
+static void bench_prio(size_t count)
+{
+    enum { LEVELS = 32, DEPTH = 256 };
+    gstack_prio *const p = gstack_prio_create(LEVELS, sizeof (size_t));
+    gstack *levels[LEVELS];
+    unsigned rng = 1, l;
+    size_t v;
+    volatile size_t sink = 0;
+    int made = 0;
+
+    while (made < LEVELS && (levels[made] = gstack_create(16, sizeof (size_t)))) {
+        ++made;
+    }
+
+    if (!p || made < LEVELS) {
+        goto out;
+    }
+
+    /* Keep DEPTH tasks queued, spread over the lower levels so that the scan
+     * has ground to cover.
+     */
+    for (size_t i = 0; i < DEPTH; ++i) {
+        if (!gstack_prio_push(p, (unsigned) i % 4, &i) || !gstack_push(levels[i % 4], &i)) {
+            goto out;
+        }
+    }
+
+    double start = bench_now();
+
+    for (size_t i = 0; i < count; ++i) {
+        rng = rng * 1103515245u + 12345u;
+        if (!gstack_prio_push(p, (rng >> 16) % LEVELS, &i) || !gstack_prio_pop(p, &v, &l)) {
+            goto out;
+        }
+        sink += v;
+    }
+
+    const double bitmap_ns = (bench_now() - start) / (double) count;
+
+    rng = 1;
+    start = bench_now();
+
+    for (size_t i = 0; i < count; ++i) {
+        rng = rng * 1103515245u + 12345u;
+        if (!gstack_push(levels[(rng >> 16) % LEVELS], &i)) {
+            goto out;
+        }
+
+        for (l = LEVELS; l-- > 0 && gstack_is_empty(levels[l]);) {
+        }
+        sink += *(const size_t *) gstack_pop(levels[l]);
+    }
+
+    const double scan_ns = (bench_now() - start) / (double) count;
+
+    (void) sink;
+    printf("\n%d priority levels, push and pop, ns/op\n", LEVELS);
+    printf("%-12s %10.3f\n%-12s %10.3f\n", "bitmap", bitmap_ns, "scan", scan_ns);
+
+out:
+    if (p) {
+        gstack_prio_destroy(p);
+    }
+    while (made > 0) {
+        gstack_destroy(levels[--made]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = (size_t) 1 << 22;
+    bool counters = false;
+    bench_result r;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--counters") == 0) {
+            counters = true;
+        } else {
+            count = strtoull(argv[i], NULL, 10);
+        }
+    }
+
+    if (count < 64) {
+        fputs("count must be at least 64.\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (counters && bench_counters_open() == 0) {
+        fputs("No counters available; check perf_event_paranoid.\n", stderr);
+        counters = false;
+    }
+
+    printf("%zu elements of %zu bytes, ns/op\n", count, sizeof (size_t));
+    printf("%-12s %10s %10s %10s %10s %12s\n", "backend", "push", "pop", "iterate", "sawtooth",
+           "peak KiB");
+
+    if (counters) {
+        printf("  %-10s", "per op");
+
+        for (int i = 0; i < BENCH_EVENTS; ++i) {
+            printf(" %10s", bench_event_names[i]);
+        }
+
+        putchar('\n');
+    }
+
+#ifdef GSTACK_BACKENDS
+    for (gstack_backend b = 0; b < GSTACK_BACKEND_COUNT; ++b) {
+        const size_t cap = b == GSTACK_BOUNDED ? count : 16;
+
+        if (bench_run(gstack_create_with(cap, sizeof (size_t), b, NULL), count, &r)) {
+            bench_report(gstack_backend_name(b), &r, counters);
+        } else {
+            printf("%-12s unavailable\n", gstack_backend_name(b));
+        }
+    }
+#else
+    if (bench_run(gstack_create(16, sizeof (size_t)), count, &r)) {
+        bench_report("contiguous", &r, counters);
+    }
+#endif                          /* GSTACK_BACKENDS */
+
+    bench_kits(count);
+    bench_roots(count);
+    bench_prio(count);
+#ifdef GSTACK_INLINE
+    bench_inline(count);
+#endif
+    bench_counters_close();
+    return EXIT_SUCCESS;
+}
+
+#endif                          /* BENCH_MAIN */
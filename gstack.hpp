@@ -0,0 +1,1208 @@
+#ifndef GSTACK_HPP
+#define GSTACK_HPP
+
+/* A C++17 counterpart of gstack.h, for C++ consumers.
+ *
+ * No implementation macro is needed: everything is a template. To use, simply
+ * include "gstack.hpp".
+ *
+ *   basic_gstack<T, Growth, Shrink, Storage, Sync>
+ *
+ * is a stack of `T` whose every policy is a type chosen at compile-time, so an
+ * instantiation contains exactly the code its policies call for and does no
+ * checks at runtime to tell which one is in use:
+ *
+ *   Growth     gstack_grow_double      Doubles the capacity. (Default.)
+ *              gstack_grow_golden      Grows the capacity by one-half.
+ *
+ *   Shrink     gstack_shrink_clrs      Halves the capacity when the count of
+ *                                      elements falls to one-fourth of it, as
+ *                                      gstack_pop() does. (Default.)
+ *              gstack_shrink_never     Never shrinks.
+ *
+ *   Storage    gstack_heap             A buffer from operator new. (Default.)
+ *              gstack_inline<N>        A buffer of N elements inside the stack
+ *                                      object. Pushing onto a full stack fails.
+ *              gstack_mmap             An anonymous mapping, grown with
+ *                                      mremap() where available. For trivially
+ *                                      copyable types only. (POSIX only.)
+ *
+ *   Sync       gstack_no_lock          No synchronization. (Default.)
+ *              gstack_spin_lock        A test-and-test-and-set spinlock with
+ *                                      exponential backoff.
+ *
+ * Both stacks store their elements contiguously, bottom first, and expose them
+ * through random-access iterators: begin()/end() from the bottom up, and
+ * rbegin()/rend() from the top down, so the standard algorithms (including
+ * the parallel ones) can run on them without popping. With C++20 ranges,
+ * bottom_up() and top_down() return views of the elements.
+ *
+ * With C++20, constexpr_gstack<T, N> is a stack that can be used in constant
+ * expressions, e.g. to build lookup tables at compile-time.
+ *
+ * With C++20 coroutines, awaitable_gstack<T, Executor> is a concurrent stack
+ * whose pop can be co_await-ed on, suspending the coroutine until an element
+ * is pushed.
+ *
+ * As in gstack.h, failing to allocate memory is reported by returning false,
+ * not by throwing. An exception thrown by a constructor of `T` propagates, and
+ * leaves the stack unchanged.
+ *
+ * Define TEST_MAIN before including this file to get a test main() program.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L && __has_include(<version>)
+    #include <version>
+
+    #if defined(__cpp_lib_ranges) && defined(__cpp_lib_span)
+        #include <ranges>
+        #include <span>
+        #define GSTACK_HPP_HAS_RANGES
+    #endif
+
+    #if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+        #include <coroutine>
+        #include <optional>
+        #define GSTACK_HPP_HAS_COROUTINES
+    #endif
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <sys/mman.h>
+    #include <unistd.h>
+
+    #if defined(MAP_ANONYMOUS)
+        #define GSTACK_HPP_HAS_MMAP
+        #define GSTACK_HPP_MAP_ANONYMOUS    MAP_ANONYMOUS
+    #elif defined(MAP_ANON)
+        #define GSTACK_HPP_HAS_MMAP
+        #define GSTACK_HPP_MAP_ANONYMOUS    MAP_ANON
+    #endif
+#endif
+
+#if defined(__cpp_constexpr_dynamic_alloc) && __cpp_constexpr_dynamic_alloc >= 201907L \
+    && defined(__cpp_lib_is_constant_evaluated)
+    #define GSTACK_HPP_HAS_CONSTEXPR_ALLOC
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define GSTACK_HPP_PAUSE()      _mm_pause()
+#elif defined(__aarch64__)
+    #define GSTACK_HPP_PAUSE()      __asm__ __volatile__("yield")
+#else
+    #define GSTACK_HPP_PAUSE()      ((void) 0)
+#endif
+
+/* Lets gstack_no_lock take no room in a stack. */
+#if defined(__has_cpp_attribute)
+    #if __has_cpp_attribute(no_unique_address)
+        #define GSTACK_HPP_NO_UNIQUE_ADDRESS    [[no_unique_address]]
+    #endif
+#endif
+
+#ifndef GSTACK_HPP_NO_UNIQUE_ADDRESS
+    #define GSTACK_HPP_NO_UNIQUE_ADDRESS
+#endif
+
+/*
+ * Growth policies. next() returns the capacity to grow to from `cap`, or 0 if
+ * it would overflow `max`.
+ */
+struct gstack_grow_double {
+    static constexpr std::size_t next(std::size_t cap, std::size_t max) noexcept
+    {
+        return cap == 0 ? 8 : cap > max / 2 ? 0 : cap * 2;
+    }
+};
+
+struct gstack_grow_golden {
+    static constexpr std::size_t next(std::size_t cap, std::size_t max) noexcept
+    {
+        return cap < 4 ? 8 : cap > max - cap / 2 ? 0 : cap + cap / 2;
+    }
+};
+
+/*
+ * Shrink policies. target() returns the capacity to shrink to after a pop has
+ * left `size` elements out of `cap`, or `cap` to keep it. A policy that never
+ * shrinks sets `enabled` to false, and the check is compiled out.
+ */
+struct gstack_shrink_clrs {
+    static constexpr bool enabled = true;
+
+    static constexpr std::size_t target(std::size_t size, std::size_t cap) noexcept
+    {
+        return size && size <= cap / 4 ? cap / 2 : cap;
+    }
+};
+
+struct gstack_shrink_never {
+    static constexpr bool enabled = false;
+
+    static constexpr std::size_t target(std::size_t, std::size_t cap) noexcept
+    {
+        return cap;
+    }
+};
+
+/* Moves `n` elements from `from` to the uninitialized `to`, and destroys them. */
+template <class T>
+void gstack_relocate(T *from, T *to, std::size_t n) noexcept
+{
+    if constexpr (std::is_trivially_copyable_v<T>) {
+        if (n) {
+            std::memcpy(static_cast<void *>(to), static_cast<const void *>(from), n * sizeof (T));
+        }
+    } else {
+        static_assert(std::is_nothrow_move_constructible_v<T>,
+                      "basic_gstack requires a noexcept move constructor to grow.");
+
+        for (std::size_t i = 0; i < n; ++i) {
+            ::new (static_cast<void *>(to + i)) T(std::move(from[i]));
+            from[i].~T();
+        }
+    }
+}
+
+/*
+ * Storage policies. Each one holds a template `storage<T>` that manages raw
+ * memory for elements of type `T`, and relocates the live ones on resize().
+ * Constructing and destroying the elements is left to basic_gstack.
+ */
+struct gstack_heap {
+    template <class T>
+    class storage {
+    public:
+        storage() noexcept = default;
+        storage(const storage &) = delete;
+        storage &operator=(const storage &) = delete;
+
+        ~storage()
+        {
+            ::operator delete(static_cast<void *>(m_data), std::align_val_t{alignof(T)});
+        }
+
+        T *data() noexcept { return m_data; }
+        const T *data() const noexcept { return m_data; }
+        std::size_t capacity() const noexcept { return m_cap; }
+        static constexpr std::size_t max_size() noexcept { return SIZE_MAX / sizeof (T); }
+
+        /* Reallocates to `new_cap` elements, keeping the first `size` ones. */
+        bool resize(std::size_t new_cap, std::size_t size) noexcept
+        {
+            T *const p = static_cast<T *>(::operator new(new_cap * sizeof (T),
+                                                         std::align_val_t{alignof(T)},
+                                                         std::nothrow));
+
+            if (!p) {
+                return false;
+            }
+
+            gstack_relocate(m_data, p, size);
+            ::operator delete(static_cast<void *>(m_data), std::align_val_t{alignof(T)});
+            m_data = p;
+            m_cap = new_cap;
+            return true;
+        }
+
+    private:
+        T *m_data = nullptr;
+        std::size_t m_cap = 0;
+    };
+};
+
+template <std::size_t N>
+struct gstack_inline {
+    static_assert(N > 0, "gstack_inline needs room for at least one element.");
+
+    template <class T>
+    class storage {
+    public:
+        T *data() noexcept { return std::launder(reinterpret_cast<T *>(m_buf)); }
+        const T *data() const noexcept { return std::launder(reinterpret_cast<const T *>(m_buf)); }
+        static constexpr std::size_t capacity() noexcept { return N; }
+        static constexpr std::size_t max_size() noexcept { return N; }
+
+        /* The buffer never moves. Shrinking is a no-op, and growing fails. */
+        static constexpr bool resize(std::size_t new_cap, std::size_t) noexcept
+        {
+            return new_cap <= N;
+        }
+
+    private:
+        alignas(T) unsigned char m_buf[N * sizeof (T)];
+    };
+};
+
+#ifdef GSTACK_HPP_HAS_MMAP
+struct gstack_mmap {
+    template <class T>
+    class storage {
+        static_assert(std::is_trivially_copyable_v<T>,
+                      "gstack_mmap moves the pages, so the elements must be trivially copyable.");
+
+    public:
+        storage() noexcept = default;
+        storage(const storage &) = delete;
+        storage &operator=(const storage &) = delete;
+
+        ~storage()
+        {
+            if (m_len) {
+                munmap(m_data, m_len);
+            }
+        }
+
+        T *data() noexcept { return static_cast<T *>(m_data); }
+        const T *data() const noexcept { return static_cast<const T *>(m_data); }
+        std::size_t capacity() const noexcept { return m_len / sizeof (T); }
+        static constexpr std::size_t max_size() noexcept { return SIZE_MAX / 2 / sizeof (T); }
+
+        bool resize(std::size_t new_cap, std::size_t size) noexcept
+        {
+            const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            const std::size_t len = (new_cap * sizeof (T) + page_size - 1) / page_size * page_size;
+
+            if (len == m_len) {
+                return true;
+            }
+
+            void *p;
+
+#ifdef MREMAP_MAYMOVE
+            if (m_len) {
+                p = mremap(m_data, m_len, len, MREMAP_MAYMOVE);
+                if (p == MAP_FAILED) {
+                    return false;
+                }
+                m_data = p;
+                m_len = len;
+                return true;
+            }
+#endif
+            p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | GSTACK_HPP_MAP_ANONYMOUS, -1, 0);
+
+            if (p == MAP_FAILED) {
+                return false;
+            }
+
+            if (m_len) {
+                std::memcpy(p, m_data, size * sizeof (T));
+                munmap(m_data, m_len);
+            }
+
+            m_data = p;
+            m_len = len;
+            return true;
+        }
+
+    private:
+        void *m_data = nullptr;
+        std::size_t m_len = 0;
+    };
+};
+#endif                          /* GSTACK_HPP_HAS_MMAP */
+
+/*
+ * Synchronization policies. Each one is a lockable with lock() and unlock().
+ */
+struct gstack_no_lock {
+    static constexpr void lock() noexcept {}
+    static constexpr void unlock() noexcept {}
+};
+
+class gstack_spin_lock {
+public:
+    void lock() noexcept
+    {
+        unsigned backoff = 1;
+
+        while (m_locked.exchange(true, std::memory_order_acquire)) {
+            /* Spin on a load, not on the exchange, so as to not bounce the
+             * cache line between the waiters.
+             */
+            while (m_locked.load(std::memory_order_relaxed)) {
+                for (unsigned i = 0; i < backoff; ++i) {
+                    GSTACK_HPP_PAUSE();
+                }
+                if (backoff < 1024) {
+                    backoff *= 2;
+                }
+            }
+        }
+    }
+
+    void unlock() noexcept
+    {
+        m_locked.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> m_locked{false};
+};
+
+template <class T,
+          class Growth = gstack_grow_double,
+          class Shrink = gstack_shrink_clrs,
+          class Storage = gstack_heap,
+          class Sync = gstack_no_lock>
+class basic_gstack {
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using growth_policy = Growth;
+    using shrink_policy = Shrink;
+    using storage_type = typename Storage::template storage<T>;
+    using sync_policy = Sync;
+
+    basic_gstack() noexcept = default;
+    basic_gstack(const basic_gstack &) = delete;
+    basic_gstack &operator=(const basic_gstack &) = delete;
+
+    ~basic_gstack()
+    {
+        clear();
+    }
+
+    /*
+     * Pushes a copy of `value`, a moved `value`, or an element constructed in
+     * place from `args`. It automatically grows the stack if it is full.
+     *
+     * On a memory allocation failure, it returns false. Else it returns true.
+     */
+    [[nodiscard]] bool push(const T &value) { return emplace(value); }
+    [[nodiscard]] bool push(T &&value) { return emplace(std::move(value)); }
+
+    template <class... Args>
+    [[nodiscard]] bool emplace(Args &&...args)
+    {
+        guard g(*this);
+
+        if (m_size == m_storage.capacity() && !grow()) {
+            return false;
+        }
+
+        ::new (static_cast<void *>(m_storage.data() + m_size)) T(std::forward<Args>(args)...);
+        ++m_size;
+        return true;
+    }
+
+    /*
+     * Removes the topmost element, moving it into `out` if given.
+     *
+     * If the stack is empty, it returns false. Else it returns true.
+     */
+    bool pop(T &out)
+    {
+        guard g(*this);
+
+        if (m_size == 0) {
+            return false;
+        }
+
+        out = std::move(m_storage.data()[m_size - 1]);
+        drop_top();
+        return true;
+    }
+
+    bool pop()
+    {
+        guard g(*this);
+
+        if (m_size == 0) {
+            return false;
+        }
+
+        drop_top();
+        return true;
+    }
+
+    /*
+     * Returns a pointer to the topmost element without removing it, or nullptr
+     * if the stack is empty. The pointer is not protected by the lock.
+     */
+    T *peek() noexcept
+    {
+        guard g(*this);
+        return m_size ? m_storage.data() + m_size - 1 : nullptr;
+    }
+
+    const T *peek() const noexcept
+    {
+        guard g(*this);
+        return m_size ? m_storage.data() + m_size - 1 : nullptr;
+    }
+
+    /*
+     * Iterators over the elements. They are invalidated by any push or pop that
+     * resizes the stack, and are not protected by the lock.
+     */
+    using iterator = T *;
+    using const_iterator = const T *;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    T *data() noexcept { return m_storage.data(); }
+    const T *data() const noexcept { return m_storage.data(); }
+
+    iterator begin() noexcept { return data(); }
+    iterator end() noexcept { return data() + m_size; }
+    const_iterator begin() const noexcept { return data(); }
+    const_iterator end() const noexcept { return data() + m_size; }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+    reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+    reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+
+#ifdef GSTACK_HPP_HAS_RANGES
+    std::span<T> bottom_up() noexcept { return {data(), m_size}; }
+    std::span<const T> bottom_up() const noexcept { return {data(), m_size}; }
+    auto top_down() noexcept { return std::ranges::subrange(rbegin(), rend()); }
+    auto top_down() const noexcept { return std::ranges::subrange(rbegin(), rend()); }
+#endif
+
+    /*
+     * Ensures that `n` more elements can be pushed without growing.
+     *
+     * On a memory allocation failure, it returns false. Else it returns true.
+     */
+    [[nodiscard]] bool reserve(size_type n) noexcept
+    {
+        guard g(*this);
+
+        if (n > storage_type::max_size() - m_size) {
+            return false;
+        }
+
+        return m_size + n <= m_storage.capacity() || m_storage.resize(m_size + n, m_size);
+    }
+
+    /*
+     * Destroys all the elements. The capacity is left untouched.
+     */
+    void clear() noexcept
+    {
+        guard g(*this);
+
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            for (size_type i = m_size; i-- > 0;) {
+                m_storage.data()[i].~T();
+            }
+        }
+
+        m_size = 0;
+    }
+
+    size_type size() const noexcept
+    {
+        guard g(*this);
+        return m_size;
+    }
+
+    size_type capacity() const noexcept
+    {
+        guard g(*this);
+        return m_storage.capacity();
+    }
+
+    bool empty() const noexcept
+    {
+        guard g(*this);
+        return m_size == 0;
+    }
+
+    bool full() const noexcept
+    {
+        guard g(*this);
+        return m_size == m_storage.capacity();
+    }
+
+private:
+    /* Holds the lock for as long as it is in scope. Compiles to nothing with
+     * gstack_no_lock.
+     */
+    class guard {
+    public:
+        explicit guard(const basic_gstack &s) noexcept : m_sync(s.m_sync) { m_sync.lock(); }
+        ~guard() { m_sync.unlock(); }
+
+        guard(const guard &) = delete;
+        guard &operator=(const guard &) = delete;
+
+    private:
+        Sync &m_sync;
+    };
+
+    bool grow() noexcept
+    {
+        const size_type new_cap = Growth::next(m_storage.capacity(), storage_type::max_size());
+
+        return new_cap && m_storage.resize(new_cap, m_size);
+    }
+
+    void drop_top() noexcept
+    {
+        m_storage.data()[--m_size].~T();
+
+        if constexpr (Shrink::enabled) {
+            const size_type cap = m_storage.capacity();
+            const size_type new_cap = Shrink::target(m_size, cap);
+
+            if (new_cap < cap) {
+                /* On failure, do nothing. The original memory is left intact. */
+                (void) m_storage.resize(new_cap, m_size);
+            }
+        }
+    }
+
+    storage_type m_storage;
+    size_type m_size = 0;
+    GSTACK_HPP_NO_UNIQUE_ADDRESS mutable Sync m_sync;
+};
+
+#ifdef GSTACK_HPP_HAS_CONSTEXPR_ALLOC
+/*
+ * A stack usable in constant expressions. The first `N` elements live in an
+ * array inside the object. Past that, the elements move to a buffer from a
+ * new-expression that doubles as the stack grows, which C++20 allows during
+ * constant evaluation as long as the buffer is freed before it ends, i.e. the
+ * stack does not outlive the evaluation.
+ *
+ * `T` must be default-constructible and move-assignable, as the slots of the
+ * array are assigned to rather than constructed. A popped element is moved
+ * out of its slot, and the slot is left as is until it is pushed onto again.
+ *
+ * At runtime, failing to allocate memory is reported by returning false as in
+ * basic_gstack. During constant evaluation, it can not happen.
+ */
+template <class T, std::size_t N = 16>
+class constexpr_gstack {
+    static_assert(N > 0, "constexpr_gstack needs room for at least one element.");
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    constexpr constexpr_gstack() = default;
+    constexpr constexpr_gstack(const constexpr_gstack &) = delete;
+    constexpr constexpr_gstack &operator=(const constexpr_gstack &) = delete;
+
+    constexpr ~constexpr_gstack()
+    {
+        delete[] m_heap;
+    }
+
+    [[nodiscard]] constexpr bool push(const T &value)
+    {
+        if (m_size == m_cap && !grow()) {
+            return false;
+        }
+
+        data()[m_size++] = value;
+        return true;
+    }
+
+    [[nodiscard]] constexpr bool push(T &&value)
+    {
+        if (m_size == m_cap && !grow()) {
+            return false;
+        }
+
+        data()[m_size++] = std::move(value);
+        return true;
+    }
+
+    constexpr bool pop(T &out)
+    {
+        if (m_size == 0) {
+            return false;
+        }
+
+        out = std::move(data()[--m_size]);
+        return true;
+    }
+
+    constexpr bool pop()
+    {
+        if (m_size == 0) {
+            return false;
+        }
+
+        --m_size;
+        return true;
+    }
+
+    constexpr T *peek() noexcept { return m_size ? data() + m_size - 1 : nullptr; }
+    constexpr const T *peek() const noexcept { return m_size ? data() + m_size - 1 : nullptr; }
+
+    constexpr void clear() noexcept { m_size = 0; }
+    constexpr size_type size() const noexcept { return m_size; }
+    constexpr size_type capacity() const noexcept { return m_cap; }
+    constexpr bool empty() const noexcept { return m_size == 0; }
+
+    /* As in basic_gstack. */
+    using iterator = T *;
+    using const_iterator = const T *;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    constexpr T *data() noexcept { return m_heap ? m_heap : m_inline; }
+    constexpr const T *data() const noexcept { return m_heap ? m_heap : m_inline; }
+
+    constexpr iterator begin() noexcept { return data(); }
+    constexpr iterator end() noexcept { return data() + m_size; }
+    constexpr const_iterator begin() const noexcept { return data(); }
+    constexpr const_iterator end() const noexcept { return data() + m_size; }
+    constexpr reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+    constexpr reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+    constexpr const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+    constexpr const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+
+#ifdef GSTACK_HPP_HAS_RANGES
+    constexpr std::span<T> bottom_up() noexcept { return {data(), m_size}; }
+    constexpr std::span<const T> bottom_up() const noexcept { return {data(), m_size}; }
+    constexpr auto top_down() noexcept { return std::ranges::subrange(rbegin(), rend()); }
+    constexpr auto top_down() const noexcept { return std::ranges::subrange(rbegin(), rend()); }
+#endif
+
+private:
+    constexpr bool grow()
+    {
+        if (m_cap > SIZE_MAX / 2 / sizeof (T)) {
+            return false;
+        }
+
+        const size_type new_cap = m_cap * 2;
+        T *p;
+
+        if (std::is_constant_evaluated()) {
+            p = new T[new_cap];
+        } else {
+            p = new (std::nothrow) T[new_cap];
+
+            if (!p) {
+                return false;
+            }
+        }
+
+        for (size_type i = 0; i < m_size; ++i) {
+            p[i] = std::move(data()[i]);
+        }
+
+        delete[] m_heap;
+        m_heap = p;
+        m_cap = new_cap;
+        return true;
+    }
+
+    T m_inline[N] = {};
+    T *m_heap = nullptr;
+    size_type m_size = 0;
+    size_type m_cap = N;
+};
+#endif                          /* GSTACK_HPP_HAS_CONSTEXPR_ALLOC */
+
+#ifdef GSTACK_HPP_HAS_COROUTINES
+/*
+ * A concurrent stack of `T` whose pop suspends the awaiting coroutine while
+ * the stack is empty, instead of blocking its thread. Any number of coroutines
+ * can wait at once, at the cost of one node in each of their frames.
+ *
+ * A push onto a stack with waiters hands the element straight to the one that
+ * has waited the longest, and schedules it to resume by calling
+ * `executor.post(std::coroutine_handle<>)`, which must be safe to call from
+ * whichever thread pushes. The coroutine is never resumed inside push().
+ *
+ * `T` must be default-constructible and movable. The stack must not be
+ * destroyed whilst coroutines are waiting on it.
+ */
+template <class T, class Executor, class Sync = gstack_spin_lock>
+class awaitable_gstack {
+    struct waiter;
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    explicit awaitable_gstack(Executor &executor) noexcept : m_executor(executor) {}
+    awaitable_gstack(const awaitable_gstack &) = delete;
+    awaitable_gstack &operator=(const awaitable_gstack &) = delete;
+
+    /*
+     * Pushes `value`, or hands it to a waiting coroutine.
+     *
+     * On a memory allocation failure, it returns false. Else it returns true.
+     */
+    [[nodiscard]] bool push(T value)
+    {
+        m_sync.lock();
+
+        waiter *const w = m_head;
+
+        if (!w) {
+            const bool ok = m_stack.push(std::move(value));
+
+            m_sync.unlock();
+            return ok;
+        }
+
+        m_head = w->next;
+
+        if (!m_head) {
+            m_tail = nullptr;
+        }
+
+        --m_waiters;
+        w->value.emplace(std::move(value));
+        m_sync.unlock();
+        m_executor.post(w->handle);
+        return true;
+    }
+
+    /*
+     * Returns an awaitable that yields the topmost element once there is one:
+     *
+     *   T value = co_await stack.pop();
+     *
+     * If the stack is not empty, the coroutine does not suspend.
+     */
+    [[nodiscard]] waiter pop() noexcept
+    {
+        return waiter(*this);
+    }
+
+    /*
+     * Pops the topmost element into `out` without waiting.
+     *
+     * If the stack is empty, it returns false. Else it returns true.
+     */
+    bool try_pop(T &out)
+    {
+        m_sync.lock();
+
+        const bool ok = m_stack.pop(out);
+
+        m_sync.unlock();
+        return ok;
+    }
+
+    /* Both are only snapshots when other threads are operating on the stack. */
+    size_type size() const noexcept
+    {
+        m_sync.lock();
+
+        const size_type n = m_stack.size();
+
+        m_sync.unlock();
+        return n;
+    }
+
+    size_type waiters() const noexcept
+    {
+        m_sync.lock();
+
+        const size_type n = m_waiters;
+
+        m_sync.unlock();
+        return n;
+    }
+
+private:
+    struct waiter {
+        explicit waiter(awaitable_gstack &s) noexcept : stack(s) {}
+
+        bool await_ready()
+        {
+            T out;
+
+            if (stack.try_pop(out)) {
+                value.emplace(std::move(out));
+                return true;
+            }
+            return false;
+        }
+
+        /* Checks again under the lock, lest a push slipped in after
+         * await_ready() and found no waiter to hand the element to.
+         */
+        bool await_suspend(std::coroutine_handle<> h)
+        {
+            stack.m_sync.lock();
+
+            T out;
+
+            if (stack.m_stack.pop(out)) {
+                stack.m_sync.unlock();
+                value.emplace(std::move(out));
+                return false;
+            }
+
+            handle = h;
+
+            if (stack.m_tail) {
+                stack.m_tail->next = this;
+            } else {
+                stack.m_head = this;
+            }
+
+            stack.m_tail = this;
+            ++stack.m_waiters;
+            stack.m_sync.unlock();
+            return true;
+        }
+
+        T await_resume()
+        {
+            return std::move(*value);
+        }
+
+        awaitable_gstack &stack;
+        std::optional<T> value;
+        std::coroutine_handle<> handle;
+        waiter *next = nullptr;
+    };
+
+    Executor &m_executor;
+    mutable Sync m_sync;
+    basic_gstack<T> m_stack;
+    waiter *m_head = nullptr;       /* The waiters, oldest first. */
+    waiter *m_tail = nullptr;
+    size_type m_waiters = 0;
+};
+#endif                          /* GSTACK_HPP_HAS_COROUTINES */
+
+#ifdef TEST_MAIN
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if __has_include(<execution>)
+    #include <execution>
+#endif
+
+template <class Stack>
+static void test_policies(std::size_t count)
+{
+    Stack s;
+
+    assert(s.empty());
+    assert(!s.pop());
+    assert(!s.peek());
+
+    for (std::size_t i = 0; i < count; ++i) {
+        assert(s.push(static_cast<typename Stack::value_type>(i)));
+    }
+
+    assert(s.size() == count);
+    assert(*s.peek() == static_cast<typename Stack::value_type>(count - 1));
+
+    for (std::size_t i = count; i-- > 0;) {
+        typename Stack::value_type v;
+
+        assert(s.pop(v));
+        assert(v == static_cast<typename Stack::value_type>(i));
+    }
+
+    assert(s.empty());
+}
+
+static void test_strings()
+{
+    basic_gstack<std::string, gstack_grow_golden> s;
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(s.push(std::string(40, static_cast<char>('a' + i % 26))));
+    }
+
+    assert(s.emplace(3, 'z'));
+    assert(*s.peek() == "zzz");
+
+    std::string out;
+
+    assert(s.pop(out) && out == "zzz");
+    assert(s.pop(out) && out == std::string(40, static_cast<char>('a' + 999 % 26)));
+    s.clear();
+    assert(s.empty());
+
+    /* The elements left on the stack are destroyed with it. */
+    assert(s.push("leaked if not destroyed, as reported by the sanitizers"));
+}
+
+static void test_inline()
+{
+    basic_gstack<int, gstack_grow_double, gstack_shrink_never, gstack_inline<4>> s;
+
+    for (int i = 0; i < 4; ++i) {
+        assert(s.push(i));
+    }
+
+    assert(s.full());
+    assert(!s.push(4));
+    assert(!s.reserve(1));
+    assert(s.capacity() == 4);
+}
+
+static void test_iterators()
+{
+    basic_gstack<long> s;
+
+    assert(s.begin() == s.end());
+
+    for (long i = 0; i < 1000; ++i) {
+        assert(s.push(i));
+    }
+
+    assert(std::accumulate(s.begin(), s.end(), 0L) == 999L * 1000 / 2);
+    assert(std::find(s.cbegin(), s.cend(), 500L) - s.cbegin() == 500);
+    assert(*s.rbegin() == 999 && s.rend() - s.rbegin() == 1000);
+    assert(std::is_sorted(s.begin(), s.end()));
+
+#if defined(__cpp_lib_execution) && __cpp_lib_execution >= 201902L
+    std::for_each(std::execution::unseq, s.begin(), s.end(), [](long &x) { x *= 2; });
+#else
+    std::for_each(s.begin(), s.end(), [](long &x) { x *= 2; });
+#endif
+    assert(*s.peek() == 1998);
+
+#ifdef GSTACK_HPP_HAS_RANGES
+    static_assert(std::ranges::contiguous_range<basic_gstack<long>>);
+    static_assert(std::ranges::random_access_range<decltype(s.top_down())>);
+
+    /* Top-down is pop order. */
+    long expected = 1998;
+
+    for (long x : s.top_down()) {
+        assert(x == expected);
+        expected -= 2;
+    }
+
+    assert(std::ranges::find(s.bottom_up(), 20L) == s.bottom_up().begin() + 10);
+    assert(std::ranges::distance(s.top_down() | std::views::take(10)) == 10);
+#endif
+
+#ifdef GSTACK_HPP_HAS_CONSTEXPR_ALLOC
+    constexpr_gstack<int, 4> c;
+
+    for (int i = 0; i < 10; ++i) {
+        assert(c.push(i));
+    }
+
+    assert(std::accumulate(c.begin(), c.end(), 0) == 45);
+    assert(*c.rbegin() == 9);
+#endif
+}
+
+#ifdef GSTACK_HPP_HAS_COROUTINES
+#include <deque>
+
+/* A single-threaded event loop. */
+class test_loop {
+public:
+    void post(std::coroutine_handle<> h) { m_ready.push_back(h); }
+
+    std::size_t run()
+    {
+        std::size_t n = 0;
+
+        for (; !m_ready.empty(); ++n) {
+            const auto h = m_ready.front();
+
+            m_ready.pop_front();
+            h.resume();
+        }
+        return n;
+    }
+
+private:
+    std::deque<std::coroutine_handle<>> m_ready;
+};
+
+/* A coroutine that starts eagerly and frees itself when done. */
+struct test_task {
+    struct promise_type {
+        test_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::abort(); }
+    };
+};
+
+static test_task test_consumer(awaitable_gstack<std::string, test_loop> &s, std::size_t &total)
+{
+    for (;;) {
+        std::string value = co_await s.pop();
+
+        if (value.empty()) {
+            co_return;
+        }
+        total += value.size();
+    }
+}
+
+static void test_coroutines()
+{
+    test_loop loop;
+    awaitable_gstack<std::string, test_loop> s(loop);
+    std::size_t total = 0;
+
+    /* None of them can proceed yet. */
+    for (int i = 0; i < 1000; ++i) {
+        test_consumer(s, total);
+    }
+
+    assert(s.waiters() == 1000 && loop.run() == 0);
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(s.push(std::string(static_cast<std::size_t>(i % 10 + 1), 'x')));
+    }
+
+    assert(s.waiters() == 0 && s.size() == 0);
+    assert(loop.run() == 1000);
+    assert(total == 100 * 55);
+    assert(s.waiters() == 1000);
+
+    /* Elements pushed with no coroutine to take them stay on the stack, and are
+     * picked up without suspending.
+     */
+    std::string out;
+
+    for (int i = 0; i < 1000; ++i) {
+        assert(s.push(std::string()));
+    }
+    assert(s.waiters() == 0 && s.size() == 0 && loop.run() == 1000);
+    assert(s.push("abc") && s.push("de"));
+    assert(s.try_pop(out) && out == "de");
+    test_consumer(s, total);
+    assert(total == 100 * 55 + 3 && s.waiters() == 1);
+    assert(s.push(std::string()) && loop.run() == 1);
+}
+#endif                          /* GSTACK_HPP_HAS_COROUTINES */
+
+static void test_spin_lock()
+{
+    basic_gstack<long, gstack_grow_double, gstack_shrink_clrs, gstack_heap, gstack_spin_lock> s;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&s] {
+            for (long i = 0; i < 10000; ++i) {
+                while (!s.push(i)) {
+                    ;
+                }
+                assert(s.size() >= 1 && s.size() <= 4 && !s.empty());
+                (void) s.pop();
+            }
+        });
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    assert(s.empty());
+
+    /* A const stack takes the lock as well. */
+    const auto &view = s;
+
+    assert(!view.peek() && s.push(7) && *view.peek() == 7);
+}
+
+#ifdef GSTACK_HPP_HAS_CONSTEXPR_ALLOC
+#include <array>
+
+/* Builds a table mapping every bracket of `text` to the position of its match,
+ * or -1 if it has none, the way a parser generator would at compile-time.
+ */
+template <std::size_t Len>
+static constexpr std::array<int, Len> match_brackets(const char (&text)[Len])
+{
+    std::array<int, Len> table{};
+    constexpr_gstack<int, 2> open;
+
+    for (std::size_t i = 0; i < Len; ++i) {
+        table[i] = -1;
+
+        if (text[i] == '(') {
+            if (!open.push(static_cast<int>(i))) {
+                return {};
+            }
+        } else if (text[i] == ')') {
+            int j;
+
+            if (open.pop(j)) {
+                table[i] = j;
+                table[static_cast<std::size_t>(j)] = static_cast<int>(i);
+            }
+        }
+    }
+
+    return table;
+}
+
+static void test_constexpr()
+{
+    /* Deep enough to leave the inline buffer during constant evaluation. */
+    static constexpr auto table = match_brackets("((a)((b)(c)))");
+
+    static_assert(table[0] == 12 && table[12] == 0);
+    static_assert(table[1] == 3 && table[4] == 11 && table[5] == 7);
+    static_assert(table[2] == -1);
+
+    constexpr_gstack<std::string, 2> s;
+
+    for (int i = 0; i < 100; ++i) {
+        assert(s.push(std::to_string(i)));
+    }
+
+    std::string out;
+
+    assert(s.size() == 100 && s.capacity() >= 100);
+    assert(*s.peek() == "99");
+    assert(s.pop(out) && out == "99");
+    s.clear();
+    assert(s.empty() && !s.pop());
+}
+#endif                          /* GSTACK_HPP_HAS_CONSTEXPR_ALLOC */
+
+int main()
+{
+    test_policies<basic_gstack<std::size_t>>(200000);
+    test_policies<basic_gstack<std::size_t, gstack_grow_golden, gstack_shrink_never>>(200000);
+    test_policies<basic_gstack<double, gstack_grow_double, gstack_shrink_clrs, gstack_inline<64>>>(64);
+#ifdef GSTACK_HPP_HAS_MMAP
+    test_policies<basic_gstack<std::size_t, gstack_grow_double, gstack_shrink_clrs, gstack_mmap>>(1000000);
+#endif
+    test_strings();
+    test_inline();
+    test_spin_lock();
+    test_iterators();
+#ifdef GSTACK_HPP_HAS_COROUTINES
+    test_coroutines();
+#endif
+#ifdef GSTACK_HPP_HAS_CONSTEXPR_ALLOC
+    test_constexpr();
+#endif
+    return EXIT_SUCCESS;
+}
+
+#endif                          /* TEST_MAIN */
+
+#endif                          /* GSTACK_HPP */